@@ -154,7 +154,7 @@ CONFIG(file_audio_libav, file_audio_libsndfile|file_audio_libsox|file_audio_buil
 }
 
 # FFT Implementation libraries ----------------------------------------------------
-# For FFTW3: Allow to limit the time spent in the resize of the FFT
+# For FFTW3: Allow to limit the time spent in the resize of the FFT of libqaudioextra
 # (available only from FFTW3's version 3.1)
 # This can be useful when using the flag FFTW_MEASURE for plan construction
 # because the resize can take quite a lot of time in this case.
@@ -162,8 +162,15 @@ CONFIG(file_audio_libav, file_audio_libsndfile|file_audio_libsox|file_audio_buil
 # Thus, I prefer to use the flag FFTW_ESTIMATE.
 # Plan construction is actually very fast with FFTW_ESTIMATE so that it
 # is not really necessary to limit the plan construction time.
+# (The FFT backends of DFasma always use FFTW_MEASURE within the time limit of
+# the settings, since their wisdom is saved from one session to the next)
 #DEFINES += FFTW3RESIZINGMAXTIMESPENT
 
+# The FChT of the spectrogram is computed by warping the time axis and an FFT.
+# This flag uses instead the direct evaluation of its sum, as a reference
+# (extremely slow, only for validation).
+#DEFINES += FCHT_EXACT
+
 CONFIG(fft_fftw3, fft_fftw3|fft_builtin_fftreal){
     message(FFT Implementation: FFTW3)
     QMAKE_CXXFLAGS += -DFFT_FFTW3
@@ -182,8 +189,9 @@ CONFIG(fft_fftw3, fft_fftw3|fft_builtin_fftreal){
         }
         msvc: LIBS += $$FFT_LIBDIR/libfftw3-3.lib
         gcc: LIBS += -lfftw3-3
-        # msvc: LIBS += $$FFT_LIBDIR/libfftw3f-3.lib
-        # gcc: LIBS += -lfftw3f-3
+        # The single precision is used by the spectrogram
+        msvc: LIBS += $$FFT_LIBDIR/libfftw3f-3.lib
+        gcc: LIBS += -lfftw3f-3
     }
     unix {
         !isEmpty(FFT_LIBDIR){
@@ -195,11 +203,11 @@ CONFIG(fft_fftw3, fft_fftw3|fft_builtin_fftreal){
             message("    FFTW3 static link")
             # LIBS += $$FFT_LIBDIR/libfftw3.a
             # LIBS += -l:libfftw3.a
-            LIBS +=  -Wl,-Bstatic -lfftw3 -Wl,-Bdynamic
+            LIBS +=  -Wl,-Bstatic -lfftw3 -lfftw3f -Wl,-Bdynamic
             DEFINES += FFT_FFTW3_STATIC
         } else {
             LIBS += -lfftw3
-            # LIBS += -lfftw3f
+            LIBS += -lfftw3f # The single precision is used by the spectrogram
         }
     }
 }
@@ -309,12 +317,19 @@ SOURCES   += src/main.cpp\
              src/ftlabels.cpp \
              src/gvwaveform.cpp \
              src/gvspectrumamplitude.cpp \
-             src/fftresizethread.cpp \
+             src/dftcomputethread.cpp \
+             src/fftplancache.cpp \
+             src/windowcache.cpp \
+             src/fftbackend.cpp \
+             src/dbkernels.cpp \
              src/gvspectrumamplitudewdialogsettings.cpp \
              src/gvspectrumphase.cpp \
              src/gvspectrumgroupdelay.cpp \
              src/gvspectrogram.cpp \
              src/stftcomputethread.cpp \
+             src/stftimage.cpp \
+             src/stftstorage.cpp \
+             src/stftcache.cpp \
              src/gvspectrogramwdialogsettings.cpp \
              src/ftgenerictimevalue.cpp \
              src/gvgenerictimevalue.cpp \
@@ -347,12 +362,19 @@ HEADERS   += src/wmainwindow.h \
              src/ftlabels.h \
              src/gvwaveform.h \
              src/gvspectrumamplitude.h \
-             src/fftresizethread.h \
+             src/dftcomputethread.h \
+             src/fftplancache.h \
+             src/windowcache.h \
+             src/fftbackend.h \
+             src/dbkernels.h \
              src/gvspectrumamplitudewdialogsettings.h \
              src/gvspectrumphase.h \
              src/gvspectrumgroupdelay.h \
              src/gvspectrogram.h \
              src/stftcomputethread.h \
+             src/stftimage.h \
+             src/stftstorage.h \
+             src/stftcache.h \
              src/gvspectrogramwdialogsettings.h \
              src/ftgenerictimevalue.h \
              src/gvgenerictimevalue.h \
@@ -27,6 +27,8 @@ file provided in the source code of DFasma. Another copy can be found at
 #include "wmainwindow.h"
 #include "qaehelpers.h"
 #include "qaesigproc.h"
+#include "fftbackend.h"
+#include "dbkernels.h"
 #include "ftsound.h"
 
 #ifdef SUPPORT_SDIF
@@ -98,6 +100,7 @@ AboutBox::AboutBox(QWidget *parent) :
     if(sizeof(FFTTYPE)==16)  fftinfostr += "quadruple";
     fftinfostr += "); smallest: "+QString::number(20*log10(std::numeric_limits<FFTTYPE>::min()))+"dB)";
     ui->vlLibraries->addWidget(new QLabel(fftinfostr, this));
+    ui->vlLibraries->addWidget(new QLabel("<i>FFT backends:</i> "+FFTBackend::info()+" (dB conversion: "+DBKernels::instructionSet()+")", this));
 
     // SDIF
     QString sdifinfostr = "";
@@ -0,0 +1,417 @@
+/*
+Copyright (C) 2015  Gilles Degottex <gilles.degottex@gmail.com>
+
+This file is part of DFasma.
+
+DFasma is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DFasma is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available in the LICENSE.txt
+file provided in the source code of DFasma. Another copy can be found at
+<http://www.gnu.org/licenses/>.
+*/
+
+#include "dbkernels.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #define DBKERNELS_X86
+    #include <immintrin.h>
+#endif
+
+// Scalar ----------------------------------------------------------------------
+
+template<typename TI, typename T>
+static void powerToDBScalar(const std::complex<TI>* in, int size, T* out, T& min, T& max) {
+    for(int n=0; n<size; ++n){
+        T re = in[n].real();
+        T im = in[n].imag();
+        T value = 10.0*std::log10(re*re+im*im);
+        if(value!=value) // NaN
+            value = -std::numeric_limits<T>::infinity();
+        else if(std::abs(value)<=std::numeric_limits<T>::max()){
+            min = std::min(min, value);
+            max = std::max(max, value);
+        }
+        out[n] = value;
+    }
+}
+
+template<typename T>
+static void scaleMinMaxScalar(T* values, int size, T scale, T& min, T& max) {
+    for(int n=0; n<size; ++n){
+        T value = scale*values[n];
+        if(value!=value) // NaN
+            value = -std::numeric_limits<T>::infinity();
+        else if(std::abs(value)<=std::numeric_limits<T>::max()){
+            min = std::min(min, value);
+            max = std::max(max, value);
+        }
+        values[n] = value;
+    }
+}
+
+// x86 SIMD --------------------------------------------------------------------
+// 10*log10(p) = 10/ln(10) * (e*ln(2) + ln(m)), with p=m*2^e and m in [sqrt(2)/2,sqrt(2)[,
+// ln(m) = 2*atanh(s), with s=(m-1)/(m+1) and |s|<0.172, by its series up to s^17 (error<1e-13).
+// The vectors which contain zeros, denormals, Infs or NaNs are converted by the scalar version.
+
+#ifdef DBKERNELS_X86
+
+static const double s_db_ln2 = 0.69314718055994530942;
+static const double s_db_scale = 4.34294481903251827651; // 10/ln(10)
+
+__attribute__((target("avx2")))
+static inline __m256d powerToDBAVX2(__m256d p) {
+    __m256i bits = _mm256_castpd_si256(p);
+    // The biased exponent, as a double (through the mantissa of 2^52)
+    __m256d e = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits, 52), _mm256_set1_epi64x(0x4330000000000000LL))), _mm256_set1_pd(4503599627370496.0+1023.0));
+    __m256d m = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi64x(0x000FFFFFFFFFFFFFLL)), _mm256_set1_epi64x(0x3FF0000000000000LL)));
+    __m256d big = _mm256_cmp_pd(m, _mm256_set1_pd(1.41421356237309504880), _CMP_GT_OQ);
+    m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), big);
+    e = _mm256_add_pd(e, _mm256_and_pd(big, _mm256_set1_pd(1.0)));
+
+    __m256d s = _mm256_div_pd(_mm256_sub_pd(m, _mm256_set1_pd(1.0)), _mm256_add_pd(m, _mm256_set1_pd(1.0)));
+    __m256d z = _mm256_mul_pd(s, s);
+    __m256d r = _mm256_set1_pd(1.0/17);
+    r = _mm256_add_pd(_mm256_mul_pd(r, z), _mm256_set1_pd(1.0/15));
+    r = _mm256_add_pd(_mm256_mul_pd(r, z), _mm256_set1_pd(1.0/13));
+    r = _mm256_add_pd(_mm256_mul_pd(r, z), _mm256_set1_pd(1.0/11));
+    r = _mm256_add_pd(_mm256_mul_pd(r, z), _mm256_set1_pd(1.0/9));
+    r = _mm256_add_pd(_mm256_mul_pd(r, z), _mm256_set1_pd(1.0/7));
+    r = _mm256_add_pd(_mm256_mul_pd(r, z), _mm256_set1_pd(1.0/5));
+    r = _mm256_add_pd(_mm256_mul_pd(r, z), _mm256_set1_pd(1.0/3));
+    r = _mm256_add_pd(_mm256_mul_pd(r, z), _mm256_set1_pd(1.0));
+    __m256d lnm = _mm256_mul_pd(_mm256_add_pd(s, s), r);
+
+    return _mm256_mul_pd(_mm256_set1_pd(s_db_scale), _mm256_add_pd(_mm256_mul_pd(e, _mm256_set1_pd(s_db_ln2)), lnm));
+}
+
+// Loads 2 complex values
+__attribute__((target("avx2")))
+static inline __m256d loadComplexAVX2(const double* pin) {
+    return _mm256_loadu_pd(pin);
+}
+__attribute__((target("avx2")))
+static inline __m256d loadComplexAVX2(const float* pin) {
+    return _mm256_cvtps_pd(_mm_loadu_ps(pin));
+}
+
+template<typename TI>
+__attribute__((target("avx2")))
+static void powerToDBAVX2(const std::complex<TI>* in, int size, double* out, double& min, double& max) {
+    const TI* pin = reinterpret_cast<const TI*>(in);
+    const __m256d dblmin = _mm256_set1_pd(std::numeric_limits<double>::min());
+    const __m256d dblmax = _mm256_set1_pd(std::numeric_limits<double>::max());
+    __m256d vmin = _mm256_set1_pd(min);
+    __m256d vmax = _mm256_set1_pd(max);
+    int n = 0;
+    for(; n+4<=size; n+=4){
+        __m256d a = loadComplexAVX2(pin+2*n);     // r0 i0 r1 i1
+        __m256d b = loadComplexAVX2(pin+2*n+4);   // r2 i2 r3 i3
+        __m256d p = _mm256_hadd_pd(_mm256_mul_pd(a, a), _mm256_mul_pd(b, b)); // p0 p2 p1 p3
+        p = _mm256_permute4x64_pd(p, 0xD8);
+
+        __m256d normal = _mm256_and_pd(_mm256_cmp_pd(p, dblmin, _CMP_GE_OQ), _mm256_cmp_pd(p, dblmax, _CMP_LE_OQ));
+        if(_mm256_movemask_pd(normal)!=0xF){
+            powerToDBScalar(in+n, 4, out+n, min, max);
+            continue;
+        }
+        __m256d db = powerToDBAVX2(p);
+        _mm256_storeu_pd(out+n, db);
+        vmin = _mm256_min_pd(vmin, db);
+        vmax = _mm256_max_pd(vmax, db);
+    }
+    double lmin[4], lmax[4];
+    _mm256_storeu_pd(lmin, vmin);
+    _mm256_storeu_pd(lmax, vmax);
+    for(int l=0; l<4; ++l){
+        min = std::min(min, lmin[l]);
+        max = std::max(max, lmax[l]);
+    }
+    powerToDBScalar(in+n, size-n, out+n, min, max);
+}
+
+__attribute__((target("avx2")))
+static void scaleMinMaxAVX2(double* values, int size, double scale, double& min, double& max) {
+    const __m256d vscale = _mm256_set1_pd(scale);
+    const __m256d absmask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+    const __m256d dblmax = _mm256_set1_pd(std::numeric_limits<double>::max());
+    const __m256d inf = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+    const __m256d minf = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+    __m256d vmin = _mm256_set1_pd(min);
+    __m256d vmax = _mm256_set1_pd(max);
+    int n = 0;
+    for(; n+4<=size; n+=4){
+        __m256d v = _mm256_mul_pd(vscale, _mm256_loadu_pd(values+n));
+        __m256d finite = _mm256_cmp_pd(_mm256_and_pd(v, absmask), dblmax, _CMP_LE_OQ);
+        v = _mm256_blendv_pd(v, minf, _mm256_cmp_pd(v, v, _CMP_UNORD_Q)); // NaN
+        _mm256_storeu_pd(values+n, v);
+        vmin = _mm256_min_pd(vmin, _mm256_blendv_pd(inf, v, finite));
+        vmax = _mm256_max_pd(vmax, _mm256_blendv_pd(minf, v, finite));
+    }
+    double lmin[4], lmax[4];
+    _mm256_storeu_pd(lmin, vmin);
+    _mm256_storeu_pd(lmax, vmax);
+    for(int l=0; l<4; ++l){
+        min = std::min(min, lmin[l]);
+        max = std::max(max, lmax[l]);
+    }
+    scaleMinMaxScalar(values+n, size-n, scale, min, max);
+}
+
+__attribute__((target("sse2")))
+static inline __m128d selectSSE2(__m128d mask, __m128d a, __m128d b) { // mask?b:a
+    return _mm_or_pd(_mm_andnot_pd(mask, a), _mm_and_pd(mask, b));
+}
+
+__attribute__((target("sse2")))
+static inline __m128d powerToDBSSE2(__m128d p) {
+    __m128i bits = _mm_castpd_si128(p);
+    __m128d e = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(_mm_srli_epi64(bits, 52), _mm_set1_epi64x(0x4330000000000000LL))), _mm_set1_pd(4503599627370496.0+1023.0));
+    __m128d m = _mm_castsi128_pd(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi64x(0x000FFFFFFFFFFFFFLL)), _mm_set1_epi64x(0x3FF0000000000000LL)));
+    __m128d big = _mm_cmpgt_pd(m, _mm_set1_pd(1.41421356237309504880));
+    m = selectSSE2(big, m, _mm_mul_pd(m, _mm_set1_pd(0.5)));
+    e = _mm_add_pd(e, _mm_and_pd(big, _mm_set1_pd(1.0)));
+
+    __m128d s = _mm_div_pd(_mm_sub_pd(m, _mm_set1_pd(1.0)), _mm_add_pd(m, _mm_set1_pd(1.0)));
+    __m128d z = _mm_mul_pd(s, s);
+    __m128d r = _mm_set1_pd(1.0/17);
+    r = _mm_add_pd(_mm_mul_pd(r, z), _mm_set1_pd(1.0/15));
+    r = _mm_add_pd(_mm_mul_pd(r, z), _mm_set1_pd(1.0/13));
+    r = _mm_add_pd(_mm_mul_pd(r, z), _mm_set1_pd(1.0/11));
+    r = _mm_add_pd(_mm_mul_pd(r, z), _mm_set1_pd(1.0/9));
+    r = _mm_add_pd(_mm_mul_pd(r, z), _mm_set1_pd(1.0/7));
+    r = _mm_add_pd(_mm_mul_pd(r, z), _mm_set1_pd(1.0/5));
+    r = _mm_add_pd(_mm_mul_pd(r, z), _mm_set1_pd(1.0/3));
+    r = _mm_add_pd(_mm_mul_pd(r, z), _mm_set1_pd(1.0));
+    __m128d lnm = _mm_mul_pd(_mm_add_pd(s, s), r);
+
+    return _mm_mul_pd(_mm_set1_pd(s_db_scale), _mm_add_pd(_mm_mul_pd(e, _mm_set1_pd(s_db_ln2)), lnm));
+}
+
+// Loads 1 complex value
+__attribute__((target("sse2")))
+static inline __m128d loadComplexSSE2(const double* pin) {
+    return _mm_loadu_pd(pin);
+}
+__attribute__((target("sse2")))
+static inline __m128d loadComplexSSE2(const float* pin) {
+    return _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(pin))));
+}
+
+template<typename TI>
+__attribute__((target("sse2")))
+static void powerToDBSSE2(const std::complex<TI>* in, int size, double* out, double& min, double& max) {
+    const TI* pin = reinterpret_cast<const TI*>(in);
+    const __m128d dblmin = _mm_set1_pd(std::numeric_limits<double>::min());
+    const __m128d dblmax = _mm_set1_pd(std::numeric_limits<double>::max());
+    __m128d vmin = _mm_set1_pd(min);
+    __m128d vmax = _mm_set1_pd(max);
+    int n = 0;
+    for(; n+2<=size; n+=2){
+        __m128d a = loadComplexSSE2(pin+2*n);     // r0 i0
+        __m128d b = loadComplexSSE2(pin+2*n+2);   // r1 i1
+        a = _mm_mul_pd(a, a);
+        b = _mm_mul_pd(b, b);
+        __m128d p = _mm_add_pd(_mm_unpacklo_pd(a, b), _mm_unpackhi_pd(a, b));
+
+        __m128d normal = _mm_and_pd(_mm_cmpge_pd(p, dblmin), _mm_cmple_pd(p, dblmax));
+        if(_mm_movemask_pd(normal)!=0x3){
+            powerToDBScalar(in+n, 2, out+n, min, max);
+            continue;
+        }
+        __m128d db = powerToDBSSE2(p);
+        _mm_storeu_pd(out+n, db);
+        vmin = _mm_min_pd(vmin, db);
+        vmax = _mm_max_pd(vmax, db);
+    }
+    double lmin[2], lmax[2];
+    _mm_storeu_pd(lmin, vmin);
+    _mm_storeu_pd(lmax, vmax);
+    for(int l=0; l<2; ++l){
+        min = std::min(min, lmin[l]);
+        max = std::max(max, lmax[l]);
+    }
+    powerToDBScalar(in+n, size-n, out+n, min, max);
+}
+
+__attribute__((target("sse2")))
+static void scaleMinMaxSSE2(double* values, int size, double scale, double& min, double& max) {
+    const __m128d vscale = _mm_set1_pd(scale);
+    const __m128d absmask = _mm_castsi128_pd(_mm_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+    const __m128d dblmax = _mm_set1_pd(std::numeric_limits<double>::max());
+    const __m128d inf = _mm_set1_pd(std::numeric_limits<double>::infinity());
+    const __m128d minf = _mm_set1_pd(-std::numeric_limits<double>::infinity());
+    __m128d vmin = _mm_set1_pd(min);
+    __m128d vmax = _mm_set1_pd(max);
+    int n = 0;
+    for(; n+2<=size; n+=2){
+        __m128d v = _mm_mul_pd(vscale, _mm_loadu_pd(values+n));
+        __m128d finite = _mm_cmple_pd(_mm_and_pd(v, absmask), dblmax);
+        v = selectSSE2(_mm_cmpunord_pd(v, v), v, minf); // NaN
+        _mm_storeu_pd(values+n, v);
+        vmin = _mm_min_pd(vmin, selectSSE2(finite, inf, v));
+        vmax = _mm_max_pd(vmax, selectSSE2(finite, minf, v));
+    }
+    double lmin[2], lmax[2];
+    _mm_storeu_pd(lmin, vmin);
+    _mm_storeu_pd(lmax, vmax);
+    for(int l=0; l<2; ++l){
+        min = std::min(min, lmin[l]);
+        max = std::max(max, lmax[l]);
+    }
+    scaleMinMaxScalar(values+n, size-n, scale, min, max);
+}
+
+#endif
+
+// Self-check ------------------------------------------------------------------
+// The SIMD versions are compared to the scalar ones at startup, on a pseudo-random
+// buffer which contains zeros (thus -Inf values). A version which doesn't match
+// is not used.
+
+#ifdef DBKERNELS_X86
+
+static bool checkClose(double value, double ref) {
+    if(value==ref) // Including the Infs
+        return true;
+    return std::abs(value-ref)<=1e-9*(1.0+std::abs(ref));
+}
+
+template<typename TI>
+static bool checkKernels(void (*powertodb)(const std::complex<TI>*, int, double*, double&, double&),
+                         void (*scaleminmax)(double*, int, double, double&, double&)) {
+    const int size = 67; // Not a multiple of the vectors' size, to check the remainders too
+    std::complex<TI> in[size];
+    unsigned int seed = 1;
+    for(int n=0; n<size; ++n){
+        double rnd[3];
+        for(int k=0; k<3; ++k){
+            seed = 1664525u*seed + 1013904223u;
+            rnd[k] = (seed>>8)/double(1<<24);
+        }
+        double mag = std::pow(10.0, 8.0*rnd[2]-4.0);
+        if(n%11==3)
+            in[n] = std::complex<TI>(0.0, 0.0);
+        else
+            in[n] = std::complex<TI>(TI(mag*(2.0*rnd[0]-1.0)), TI(mag*(2.0*rnd[1]-1.0)));
+    }
+
+    double ref[size], out[size];
+    double refmin = std::numeric_limits<double>::infinity();
+    double refmax = -std::numeric_limits<double>::infinity();
+    double min = refmin;
+    double max = refmax;
+    powerToDBScalar(in, size, ref, refmin, refmax);
+    powertodb(in, size, out, min, max);
+    if(!checkClose(min, refmin) || !checkClose(max, refmax))
+        return false;
+    for(int n=0; n<size; ++n)
+        if(!checkClose(out[n], ref[n]))
+            return false;
+
+    // Scale the dB values, with their -Infs
+    std::copy(ref, ref+size, out);
+    refmin = min = std::numeric_limits<double>::infinity();
+    refmax = max = -std::numeric_limits<double>::infinity();
+    scaleMinMaxScalar(ref, size, 0.5, refmin, refmax);
+    scaleminmax(out, size, 0.5, min, max);
+    if(!checkClose(min, refmin) || !checkClose(max, refmax))
+        return false;
+    for(int n=0; n<size; ++n)
+        if(!checkClose(out[n], ref[n]))
+            return false;
+
+    return true;
+}
+
+#endif
+
+// Dispatch --------------------------------------------------------------------
+
+enum DBKernelsISA {DKScalar=0, DKSSE2=1, DKAVX2=2};
+
+static int detectISA() {
+    #ifdef DBKERNELS_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2")
+           && checkKernels<double>(powerToDBAVX2<double>, scaleMinMaxAVX2)
+           && checkKernels<float>(powerToDBAVX2<float>, scaleMinMaxAVX2))
+            return DKAVX2;
+        if(__builtin_cpu_supports("sse2")
+           && checkKernels<double>(powerToDBSSE2<double>, scaleMinMaxSSE2)
+           && checkKernels<float>(powerToDBSSE2<float>, scaleMinMaxSSE2))
+            return DKSSE2;
+    #endif
+    return DKScalar;
+}
+static const int s_isa = detectISA();
+
+// The SIMD versions are for double only (FFTTYPE might be float)
+template<typename TI, typename T>
+static inline void powerToDBDispatch(const std::complex<TI>* in, int size, T* out, T& min, T& max) {
+    powerToDBScalar(in, size, out, min, max);
+}
+template<typename TI>
+static inline void powerToDBDispatch(const std::complex<TI>* in, int size, double* out, double& min, double& max) {
+    #ifdef DBKERNELS_X86
+        if(s_isa==DKAVX2)
+            return powerToDBAVX2(in, size, out, min, max);
+        if(s_isa==DKSSE2)
+            return powerToDBSSE2(in, size, out, min, max);
+    #endif
+    powerToDBScalar(in, size, out, min, max);
+}
+
+template<typename T>
+static inline void scaleMinMaxDispatch(T* values, int size, T scale, T& min, T& max) {
+    scaleMinMaxScalar(values, size, scale, min, max);
+}
+static inline void scaleMinMaxDispatch(double* values, int size, double scale, double& min, double& max) {
+    #ifdef DBKERNELS_X86
+        if(s_isa==DKAVX2)
+            return scaleMinMaxAVX2(values, size, scale, min, max);
+        if(s_isa==DKSSE2)
+            return scaleMinMaxSSE2(values, size, scale, min, max);
+    #endif
+    scaleMinMaxScalar(values, size, scale, min, max);
+}
+
+void DBKernels::powerToDB(const std::complex<FFTTYPE>* in, int size, FFTTYPE* out, FFTTYPE& min, FFTTYPE& max) {
+    powerToDBDispatch(in, size, out, min, max);
+}
+
+#ifndef SIGPROC_FLOAT
+void DBKernels::powerToDB(const std::complex<float>* in, int size, FFTTYPE* out, FFTTYPE& min, FFTTYPE& max) {
+    powerToDBDispatch(in, size, out, min, max);
+}
+#endif
+
+void DBKernels::powerToDB(const std::complex<FFTTYPE>* in, int size, FFTTYPE* out) {
+    FFTTYPE min = std::numeric_limits<FFTTYPE>::infinity();
+    FFTTYPE max = -std::numeric_limits<FFTTYPE>::infinity();
+    powerToDBDispatch(in, size, out, min, max);
+}
+
+void DBKernels::scaleMinMax(FFTTYPE* values, int size, FFTTYPE scale, FFTTYPE& min, FFTTYPE& max) {
+    scaleMinMaxDispatch(values, size, scale, min, max);
+}
+
+QString DBKernels::instructionSet() {
+    if(s_isa==DKAVX2)
+        return "AVX2";
+    else if(s_isa==DKSSE2)
+        return "SSE2";
+    return "scalar";
+}
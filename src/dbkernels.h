@@ -0,0 +1,51 @@
+/*
+Copyright (C) 2015  Gilles Degottex <gilles.degottex@gmail.com>
+
+This file is part of DFasma.
+
+DFasma is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DFasma is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available in the LICENSE.txt
+file provided in the source code of DFasma. Another copy can be found at
+<http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DBKERNELS_H
+#define DBKERNELS_H
+
+#include <complex>
+
+#include <QString>
+
+#include "qaesigproc.h"
+
+// The conversions of the DFT's outputs to [dB], shared by the spectrum and the spectrogram.
+// The AVX2 or SSE2 version is chosen at runtime, according to the CPU
+// (with a scalar fallback for the other CPUs and compilers).
+class DBKernels
+{
+public:
+    // out[n] = 10*log10(|in[n]|^2) [dB] for n in [0,size[ (NaN giving -Inf),
+    // and min and max are updated with the finite values of out.
+    static void powerToDB(const std::complex<FFTTYPE>* in, int size, FFTTYPE* out, FFTTYPE& min, FFTTYPE& max);
+    static void powerToDB(const std::complex<FFTTYPE>* in, int size, FFTTYPE* out); // Same, without min and max
+    #ifndef SIGPROC_FLOAT
+    static void powerToDB(const std::complex<float>* in, int size, FFTTYPE* out, FFTTYPE& min, FFTTYPE& max); // Same, from single precision values
+    #endif
+
+    // values[n] *= scale for n in [0,size[ (NaN giving -Inf),
+    // and min and max are updated with the finite values.
+    static void scaleMinMax(FFTTYPE* values, int size, FFTTYPE scale, FFTTYPE& min, FFTTYPE& max);
+
+    static QString instructionSet(); // The one used, for the about box
+};
+
+#endif // DBKERNELS_H
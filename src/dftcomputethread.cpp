@@ -0,0 +1,395 @@
+/*
+Copyright (C) 2015  Gilles Degottex <gilles.degottex@gmail.com>
+
+This file is part of DFasma.
+
+DFasma is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DFasma is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available in the LICENSE.txt
+file provided in the source code of DFasma. Another copy can be found at
+<http://www.gnu.org/licenses/>.
+*/
+
+#include "dftcomputethread.h"
+
+#include <limits>
+#include <algorithm>
+
+#include "qaehelpers.h"
+#include "fftplancache.h"
+#include "dbkernels.h"
+
+DFTWorker::DFTWorker(DFTComputeThread* dftthread)
+    : QThread(dftthread)
+    , m_dftthread(dftthread)
+    , m_snd(NULL)
+{
+    m_fft = new FFTTransformer();
+}
+
+void DFTWorker::run() {
+    m_dftthread->computeDFTs(this);
+
+    m_dftthread->m_workers_done.release();
+}
+
+DFTWorker::~DFTWorker(){
+    FFTPlanCache::give(m_fft); // Its plans are destroyed under the cache's lock
+}
+
+DFTComputeThread::DFTComputeThread(QObject* parent)
+    : QThread(parent)
+    , m_quit(false)
+    , m_computing(false)
+    , m_hasrequest(false)
+    , m_running_next(0)
+    , m_windft_dftlen(0)
+{
+    int nbworkers = std::max(1, QThread::idealThreadCount());
+    for(int wi=0; wi<nbworkers; ++wi)
+        m_workers.push_back(new DFTWorker(this));
+}
+
+void DFTComputeThread::compute(const Request& req) {
+//    COUTD << "DFTComputeThread::compute" << std::endl;
+
+    m_mutex_request.lock();
+
+    m_request = req;
+
+    // Drop the sounds which are already computed with the very same parameters
+    if(m_computing && m_running.params==req.params && (m_running.groupdelay || !req.groupdelay)){
+        m_request.snds.clear();
+        m_request.sndparams.clear();
+        for(size_t si=0; si<req.snds.size(); ++si){
+            bool isrunning = false;
+            for(size_t ri=0; ri<m_running.snds.size() && !isrunning; ++ri)
+                isrunning = m_running.snds[ri]==req.snds[si]
+                            && m_running.sndparams[ri]==req.sndparams[si]
+                            && m_running.sndparams[ri].ampscale==req.sndparams[si].ampscale
+                            && m_running.sndparams[ri].delay==req.sndparams[si].delay;
+            if(!isrunning){
+                m_request.snds.push_back(req.snds[si]);
+                m_request.sndparams.push_back(req.sndparams[si]);
+            }
+        }
+        if(m_running.window)
+            m_request.window = false;
+    }
+
+    // The results not yet taken for the sounds to compute again are obsolete
+    for(size_t ri=0; ri<m_results.size(); ){
+        if(std::find(m_request.snds.begin(), m_request.snds.end(), m_results[ri].snd)!=m_request.snds.end())
+            m_results.erase(m_results.begin()+ri);
+        else
+            ++ri;
+    }
+
+    m_hasrequest = m_request.snds.size()>0 || m_request.window;
+
+    if(m_hasrequest){
+        if(!isRunning())
+            start(); // Runs until the destruction, waiting for the next requests
+        m_request_cond.wakeOne();
+    }
+
+    m_mutex_request.unlock();
+}
+
+void DFTComputeThread::run() {
+//    COUTD << "DFTComputeThread::run" << std::endl;
+
+    // The thread runs until it is destroyed, so that compute() never waits for it to end
+    for(;;){
+        m_mutex_request.lock();
+        if(!m_hasrequest && m_computing){
+            m_running = Request();
+            m_computing = false;
+            m_done_cond.wakeAll();
+        }
+        // Sleep until compute() sets a request
+        while(!m_hasrequest && !m_quit)
+            m_request_cond.wait(&m_mutex_request);
+        if(m_quit){
+            m_mutex_request.unlock();
+            break;
+        }
+        m_computing = true;
+        m_running = m_request;
+        m_running_next = 0;
+        m_hasrequest = false;
+        int nbitems = int(m_running.snds.size()) + (m_running.window?1:0);
+        m_mutex_request.unlock();
+
+        // Only the workers which have something to do are used
+        int nbworkers = std::min(int(m_workers.size()), nbitems);
+        if(nbworkers==0) // All canceled meanwhile
+            continue;
+
+        int dftlen = m_running.params.dftlen;
+        if(m_workers[0]->m_fft->size()!=dftlen)
+            emit fftResizing(m_workers[0]->m_fft->size(), dftlen);
+        for(int wi=0; wi<nbworkers; ++wi){
+            FFTPlanCache::resize(m_workers[wi]->m_fft, dftlen); // Immediate if this size has been used recently
+            if(m_running.groupdelay)
+                FFTPlanCache::preparePair(m_workers[wi]->m_fft);
+        }
+
+        for(int wi=0; wi<nbworkers; ++wi)
+            m_workers[wi]->start();
+        m_workers_done.acquire(nbworkers);
+        for(int wi=0; wi<nbworkers; ++wi)
+            m_workers[wi]->wait();
+    }
+
+//    COUTD << "DFTComputeThread::~run" << std::endl;
+}
+
+void DFTComputeThread::computeDFTs(DFTWorker* worker) {
+
+    const Request& req = m_running; // Only the sounds and window can change (read under m_mutex_request)
+
+    for(;;){
+        m_mutex_request.lock();
+        int si = m_running_next++;
+        FTSound* snd = NULL;
+        bool window = false;
+        if(si<int(req.snds.size()))
+            snd = req.snds[si];
+        else if(si==int(req.snds.size()) && req.window)
+            window = true;
+        else {
+            m_mutex_request.unlock();
+            break;
+        }
+        worker->m_snd = snd;
+        m_mutex_request.unlock();
+
+        if(window){
+            computeWindowDFT(worker, req);
+            emit dftsReady();
+        }
+        else if(snd!=NULL){ // Otherwise, canceled meanwhile
+            Result res;
+            res.snd = snd;
+            computeDFT(worker, req, si, res);
+
+            m_mutex_request.lock();
+            if(req.snds[si]!=NULL){
+                m_results.push_back(Result());
+                m_results.back().snd = res.snd;
+                m_results.back().params = res.params;
+                m_results.back().amp.swap(res.amp);
+                m_results.back().phase.swap(res.phase);
+                m_results.back().gd.swap(res.gd);
+            }
+            worker->m_snd = NULL;
+            m_done_cond.wakeAll();
+            m_mutex_request.unlock();
+
+            emit dftsReady();
+        }
+    }
+}
+
+void DFTComputeThread::computeDFT(DFTWorker* worker, const Request& req, int si, Result& res) {
+
+    const FTSound::DFTParameters& params = req.params;
+    const std::vector<FFTTYPE>& win = params.win.values(); // For speeding up access
+    FFTTransformer* fft = worker->m_fft;
+    int dftlen = fft->size();
+
+    res.params = params;
+    res.params.wav = req.sndparams[si].wav;
+    res.params.ampscale = req.sndparams[si].ampscale;
+    res.params.delay = req.sndparams[si].delay;
+
+    const std::vector<WAVTYPE>& wav = *(res.params.wav);
+    WAVTYPE gain = res.params.ampscale;
+
+    int n = 0;
+    int wn = 0;
+    for(; n<params.winlen; n++){
+        wn = params.nl+n - res.params.delay;
+
+        if(wn>=0 && wn<int(wav.size())) {
+            WAVTYPE value = gain*wav[wn];
+
+            if(value>1.0)       value = 1.0;
+            else if(value<-1.0) value = -1.0;
+
+            fft->in[n] = value*win[n];
+        }
+        else
+            fft->in[n] = 0.0;
+    }
+    for(; n<dftlen; n++)
+        fft->in[n] = 0.0;
+
+    if(req.groupdelay){
+        // y = (n/winlen)x[n], transformed together with x
+        // (the normalization keeps x and y in the same range, for the precision of their separation)
+        for(n=0; n<params.winlen; n++)
+            fft->in2[n] = (FFTTYPE(n)/params.winlen)*fft->in[n];
+        for(; n<dftlen; n++)
+            fft->in2[n] = 0.0;
+
+        fft->executePair(); // Compute the DFTs of x and y
+    }
+    else
+        fft->execute(); // Compute the DFT
+
+    const std::complex<FFTTYPE>* dft = &(fft->out[0]);
+
+    res.amp.resize(dftlen/2+1);
+    DBKernels::powerToDB(dft, dftlen/2+1, &(res.amp[0])); // The amplitude's range is updated by the GUI item
+
+    res.phase.resize(dftlen/2+1);
+    double delay = (2.0*M_PI*(win.size()-1)/2.0)/dftlen;
+    for(n=0; n<dftlen/2+1; n++){
+        if(qIsInf(res.amp[n]))
+            res.phase[n] = std::numeric_limits<WAVTYPE>::infinity();
+        else
+            res.phase[n] = qae::wrap(std::arg(dft[n])+delay*n);
+    }
+
+    // If the group delay is requested, compute it too
+    if(req.groupdelay){
+        const std::complex<FFTTYPE>* dfty = &(fft->out2[0]);
+
+        // winlen*(Xr*Yr+Xi*Yi) / |X|^2
+        res.gd.resize(dftlen/2+1);
+        WAVTYPE fs = req.fs;
+        WAVTYPE delay = ((params.winlen-1)/2)/fs;
+        for(int n=0; n<dftlen/2+1; n++) {
+            if(qIsInf(res.amp[n]))
+                res.gd[n] = std::numeric_limits<WAVTYPE>::infinity();
+            else {
+                WAVTYPE xp2 = std::real(dft[n])*std::real(dft[n]) + std::imag(dft[n])*std::imag(dft[n]);
+                res.gd[n] = params.winlen*(std::real(dft[n])*std::real(dfty[n]) + std::imag(dft[n])*std::imag(dfty[n]))/xp2;
+
+                res.gd[n] /= fs; // measure it in [second]
+
+                res.gd[n] -= delay; // Remove the window's delay
+            }
+        }
+    }
+}
+
+void DFTComputeThread::computeWindowDFT(DFTWorker* worker, const Request& req) {
+
+    FFTTransformer* fft = worker->m_fft;
+    int dftlen = fft->size();
+
+    const std::vector<FFTTYPE>& win = req.params.win.values();
+    int n = 0;
+    for(; n<req.params.winlen; n++)
+        fft->in[n] = win[n];
+    for(; n<dftlen; n++)
+        fft->in[n] = 0.0;
+
+    fft->execute();
+
+    std::vector<FFTTYPE> windft(dftlen/2+1);
+    for(n=0; n<dftlen/2+1; n++)
+        windft[n] = qae::mag2db(fft->out[n]);
+
+    m_mutex_request.lock();
+    m_windft.swap(windft);
+    m_windft_dftlen = dftlen;
+    m_mutex_request.unlock();
+}
+
+int DFTComputeThread::takeResults(std::vector<Result>& results, std::vector<FFTTYPE>& windft) {
+    results.clear();
+
+    m_mutex_request.lock();
+
+    results.swap(m_results);
+
+    int windftlen = m_windft_dftlen;
+    if(windftlen>0){
+        windft.swap(m_windft);
+        m_windft.clear();
+        m_windft_dftlen = 0;
+    }
+
+    m_mutex_request.unlock();
+
+    return windftlen;
+}
+
+void DFTComputeThread::cancelComputation(FTSound* snd, bool waittoend) {
+    m_mutex_request.lock();
+
+    // Remove it from the pending request
+    for(size_t si=0; si<m_request.snds.size(); ){
+        if(m_request.snds[si]==snd){
+            m_request.snds.erase(m_request.snds.begin()+si);
+            m_request.sndparams.erase(m_request.sndparams.begin()+si);
+        }
+        else
+            ++si;
+    }
+
+    // Skip it in the running one
+    for(size_t si=0; si<m_running.snds.size(); ++si)
+        if(m_running.snds[si]==snd)
+            m_running.snds[si] = NULL;
+
+    // Forget its results
+    for(size_t ri=0; ri<m_results.size(); ){
+        if(m_results[ri].snd==snd)
+            m_results.erase(m_results.begin()+ri);
+        else
+            ++ri;
+    }
+
+    // And wait for its DFT to finish, if it is being computed
+    while(waittoend){
+        bool iscomputing = false;
+        for(size_t wi=0; wi<m_workers.size(); ++wi)
+            iscomputing = iscomputing || m_workers[wi]->m_snd==snd;
+        if(!iscomputing)
+            break;
+        m_done_cond.wait(&m_mutex_request);
+    }
+
+    m_mutex_request.unlock();
+}
+
+void DFTComputeThread::cancelCurrentComputation(bool waittoend) {
+    m_mutex_request.lock();
+    m_hasrequest = false;
+    m_request = Request();
+    for(size_t si=0; si<m_running.snds.size(); ++si)
+        m_running.snds[si] = NULL;
+    m_running.window = false;
+    // The thread is idle once its workers have returned
+    while(waittoend && m_computing)
+        m_done_cond.wait(&m_mutex_request);
+    m_mutex_request.unlock();
+}
+
+DFTComputeThread::~DFTComputeThread() {
+    // Cancel everything and end the thread
+    cancelCurrentComputation(true);
+    m_mutex_request.lock();
+    m_quit = true;
+    m_request_cond.wakeAll();
+    m_mutex_request.unlock();
+    wait();
+
+    for(size_t wi=0; wi<m_workers.size(); ++wi){
+        m_workers[wi]->wait();
+        delete m_workers[wi];
+    }
+}
@@ -0,0 +1,133 @@
+/*
+Copyright (C) 2015  Gilles Degottex <gilles.degottex@gmail.com>
+
+This file is part of DFasma.
+
+DFasma is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DFasma is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available in the LICENSE.txt
+file provided in the source code of DFasma. Another copy can be found at
+<http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DFTCOMPUTETHREAD_H
+#define DFTCOMPUTETHREAD_H
+
+#include <vector>
+
+#include <QThread>
+#include <QMutex>
+#include <QSemaphore>
+#include <QWaitCondition>
+
+#include "qaesigproc.h"
+#include "fftbackend.h"
+#include "ftsound.h"
+
+class DFTComputeThread;
+
+// Computes the DFTs of some of the sounds of a request, in parallel of the other workers
+// (each worker has its own FFT plan and buffers)
+class DFTWorker : public QThread
+{
+    DFTComputeThread* m_dftthread;
+
+    void run(); //Q_DECL_OVERRIDE
+
+public:
+    DFTWorker(DFTComputeThread* dftthread);
+
+    FFTTransformer* m_fft;
+    FTSound* m_snd; // The sound whose DFT is being computed (NULL if none)
+
+    ~DFTWorker();
+};
+
+// Computes the amplitude, phase and group delay spectra of the sounds
+// in the background, for the spectrum views.
+// Only the latest request is computed, the pending ones are replaced by any newer one.
+// The sounds of a request are distributed among a pool of workers.
+// The results are then taken by the GUI thread (see takeResults()).
+class DFTComputeThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    class Request{
+    public:
+        FTSound::DFTParameters params;  // The window and DFT parameters
+        std::vector<FTSound*> snds;     // The sounds whose DFTs have to be updated
+        std::vector<FTSound::DFTParameters> sndparams; // ... with their specific parameters (wav, ampscale, delay)
+        bool groupdelay;                // Compute also the group delay
+        bool window;                    // Compute also the window's spectrum
+        double fs;                      // [Hz]
+
+        Request() : groupdelay(false), window(false), fs(1.0) {}
+    };
+
+    class Result{
+    public:
+        FTSound* snd;
+        FTSound::DFTParameters params;  // The parameters used, with the sound's specific ones
+        std::vector<FFTTYPE> amp;       // [dB]
+        std::vector<FFTTYPE> phase;     // [rad]
+        std::vector<FFTTYPE> gd;        // [s] (empty if not requested)
+
+        Result() : snd(NULL) {}
+    };
+
+private:
+    // The pool of workers computing the DFTs
+    std::vector<DFTWorker*> m_workers;
+    QSemaphore m_workers_done;  // Released once by each worker when finished
+
+    mutable QMutex m_mutex_request; // To protect the access to the variables below (and the workers' m_snd)
+    bool m_quit;                // The thread has to end (see ~DFTComputeThread)
+    QWaitCondition m_request_cond;  // Wakes the thread up when m_hasrequest is set or when it has to end
+    QWaitCondition m_done_cond;     // Signaled when a worker's m_snd is reset and when the thread becomes idle
+    bool m_computing;           // The thread is processing requests
+    bool m_hasrequest;
+    Request m_request;          // The next request to compute (replaced by any newer one)
+    Request m_running;          // The request being computed (its canceled sounds are set to NULL)
+    int m_running_next;         // The next sound of m_running to compute (the window's spectrum after the last one)
+    std::vector<Result> m_results; // The results not yet taken by the GUI
+    std::vector<FFTTYPE> m_windft; // The window's spectrum not yet taken by the GUI [dB]
+    int m_windft_dftlen;        // 0 if none
+
+    friend class DFTWorker;
+    void computeDFTs(DFTWorker* worker); // Compute the sounds of m_running until there is no more to do
+    void computeDFT(DFTWorker* worker, const Request& req, int si, Result& res); // res.snd has to be set
+    void computeWindowDFT(DFTWorker* worker, const Request& req);
+
+    void run(); //Q_DECL_OVERRIDE
+
+signals:
+    void fftResizing(int prevSize, int newSize);
+    void dftsReady();   // Some results can be taken
+
+public:
+    DFTComputeThread(QObject* parent);
+
+    void compute(const Request& req); // Entry point
+
+    // Takes the results computed since the last call (and the window's spectrum, if any)
+    // Returns the DFT size of the window's spectrum (0 if none)
+    int takeResults(std::vector<Result>& results, std::vector<FFTTYPE>& windft);
+
+    // Forget any DFT of this sound, waiting for it if it is being computed and waittoend is true
+    // (has to be called with waittoend before the sound is deleted or its signal is modified)
+    void cancelComputation(FTSound* snd, bool waittoend=true);
+    void cancelCurrentComputation(bool waittoend=false);
+
+    ~DFTComputeThread();
+};
+
+#endif // DFTCOMPUTETHREAD_H
@@ -0,0 +1,846 @@
+/*
+Copyright (C) 2015  Gilles Degottex <gilles.degottex@gmail.com>
+
+This file is part of DFasma.
+
+DFasma is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DFasma is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available in the LICENSE.txt
+file provided in the source code of DFasma. Another copy can be found at
+<http://www.gnu.org/licenses/>.
+*/
+
+#include "fftbackend.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QStringList>
+
+#ifdef FFT_FFTW3
+    #include <fftw3.h>
+#endif
+#ifdef FFT_FFTREAL
+    #include "../external/libqaudioextra/external/FFTReal/FFTReal.h"
+#endif
+
+#ifndef M_PI
+    #define M_PI 3.14159265358979323846
+#endif
+
+static inline bool isPowerOfTwo(int size) {
+    return size>0 && (size&(size-1))==0;
+}
+
+void FFTBackend::prepareBatch(int size, int count) {
+    m_batch_size = size;
+    m_batch_count = count;
+    m_batch_in.assign(qint64(size)*count, 0.0);
+    m_batch_out.resize(qint64(size/2+1)*count);
+}
+
+void FFTBackend::executeBatch(int count) {
+    for(int i=0; i<count; ++i)
+        execute(&(m_batch_in[0])+qint64(i)*m_batch_size, &(m_batch_out[0])+qint64(i)*(m_batch_size/2+1));
+}
+
+void FFTBackend::executePair(const FFTTYPE* x, const FFTTYPE* y, std::complex<FFTTYPE>* xout, std::complex<FFTTYPE>* yout) {
+    execute(x, xout);
+    execute(y, yout);
+}
+
+// Separates the DFTs X and Y of two real signals x and y from the DFT Z of x+iy:
+// X[k] = (Z[k]+conj(Z[N-k]))/2 and Y[k] = -i(Z[k]-conj(Z[N-k]))/2, for k in [0,N/2]
+// (the values of Z being every stride elements of zr and zi)
+template<typename T>
+static inline void separatePair(const T* zr, const T* zi, int stride, int size, std::complex<FFTTYPE>* xout, std::complex<FFTTYPE>* yout) {
+    for(int k=0; k<size/2+1; ++k){
+        qint64 pk = qint64(stride)*k;
+        qint64 nk = qint64(stride)*((size-k)%size);
+        xout[k] = std::complex<FFTTYPE>(T(0.5)*(zr[pk]+zr[nk]), T(0.5)*(zi[pk]-zi[nk]));
+        yout[k] = std::complex<FFTTYPE>(T(0.5)*(zi[pk]+zi[nk]), T(-0.5)*(zr[pk]-zr[nk]));
+    }
+}
+
+#ifdef FFT_FFTW3
+// FFTW3 ------------------------------------------------------------------------
+
+// The plans are measured, within this time limit, since their wisdom is saved
+// for the next sessions (see FFTPlanCache::saveWisdom()), which then get them
+// immediately. With FFTW_ESTIMATE, the wisdom would be useless.
+static double s_fftw3_timelimit = 1.0; // [s] (as the default of the settings)
+
+class FFTBackendFFTW3 : public FFTBackend
+{
+    int m_size;
+    double* m_in;
+    fftw_complex* m_out;
+    fftw_plan m_plan;
+
+    // The batch, with a plan for all its frames at once
+    double* m_batchin;
+    fftw_complex* m_batchout;
+    fftw_plan m_batchplan;
+
+    // The complex DFT of the pairs of frames
+    fftw_complex* m_pairin;
+    fftw_complex* m_pairout;
+    fftw_plan m_pairplan;
+
+    void clearPair(){
+        if(m_pairplan) fftw_destroy_plan(m_pairplan);
+        if(m_pairin) fftw_free(m_pairin);
+        if(m_pairout) fftw_free(m_pairout);
+        m_pairplan = NULL;
+        m_pairin = NULL;
+        m_pairout = NULL;
+    }
+    void clearBatch(){
+        if(m_batchplan) fftw_destroy_plan(m_batchplan);
+        if(m_batchin) fftw_free(m_batchin);
+        if(m_batchout) fftw_free(m_batchout);
+        m_batchplan = NULL;
+        m_batchin = NULL;
+        m_batchout = NULL;
+        m_batch_count = 0;
+    }
+    void clear(){
+        clearBatch();
+        clearPair();
+        if(m_plan) fftw_destroy_plan(m_plan);
+        if(m_in) fftw_free(m_in);
+        if(m_out) fftw_free(m_out);
+        m_plan = NULL;
+        m_in = NULL;
+        m_out = NULL;
+        m_size = 0;
+    }
+    unsigned int planFlags(){
+        // (called under the lock of the plans, see FFTPlanCache)
+        if(s_fftw3_timelimit<=0.0)
+            return FFTW_ESTIMATE;
+        fftw_set_timelimit(s_fftw3_timelimit);
+        return FFTW_MEASURE;
+    }
+
+public:
+    FFTBackendFFTW3()
+        : m_size(0)
+        , m_in(NULL)
+        , m_out(NULL)
+        , m_plan(NULL)
+        , m_batchin(NULL)
+        , m_batchout(NULL)
+        , m_batchplan(NULL)
+        , m_pairin(NULL)
+        , m_pairout(NULL)
+        , m_pairplan(NULL)
+    {}
+
+    bool supports(int size) const {
+        return size>=2;
+    }
+
+    void resize(int size){
+        if(size==m_size)
+            return;
+        clear();
+        m_size = size;
+        m_in = (double*)fftw_malloc(sizeof(double)*size);
+        m_out = (fftw_complex*)fftw_malloc(sizeof(fftw_complex)*(size/2+1));
+        // The buffers are owned, so that the plan can use their (SIMD) alignment
+        m_plan = fftw_plan_dft_r2c_1d(size, m_in, m_out, planFlags());
+    }
+
+    void execute(const FFTTYPE* in, std::complex<FFTTYPE>* out){
+        std::copy(in, in+m_size, m_in);
+        fftw_execute(m_plan);
+        for(int k=0; k<m_size/2+1; ++k)
+            out[k] = std::complex<FFTTYPE>(m_out[k][0], m_out[k][1]);
+    }
+
+    void preparePair(int size){
+        if(m_pairplan)
+            return;
+        m_pairin = (fftw_complex*)fftw_malloc(sizeof(fftw_complex)*size);
+        m_pairout = (fftw_complex*)fftw_malloc(sizeof(fftw_complex)*size);
+        m_pairplan = fftw_plan_dft_1d(size, m_pairin, m_pairout, FFTW_FORWARD, planFlags());
+    }
+    void executePair(const FFTTYPE* x, const FFTTYPE* y, std::complex<FFTTYPE>* xout, std::complex<FFTTYPE>* yout){
+        for(int n=0; n<m_size; ++n){
+            m_pairin[n][0] = x[n];
+            m_pairin[n][1] = y[n];
+        }
+        fftw_execute(m_pairplan);
+        // (fftw_complex are interleaved real and imaginary parts)
+        separatePair(&(m_pairout[0][0]), &(m_pairout[0][1]), 2, m_size, xout, yout);
+    }
+
+    #ifndef SIGPROC_FLOAT
+    // (the batch uses the buffers of FFTW3 directly, only if their type is FFTTYPE)
+    void prepareBatch(int size, int count){
+        if(size==m_batch_size && count==m_batch_count)
+            return;
+        clearBatch();
+        m_batch_size = size;
+        m_batch_count = count;
+        int dftsize = size/2+1;
+        m_batchin = (double*)fftw_malloc(sizeof(double)*size*count);
+        m_batchout = (fftw_complex*)fftw_malloc(sizeof(fftw_complex)*dftsize*count);
+        m_batchplan = fftw_plan_many_dft_r2c(1, &size, count, m_batchin, NULL, 1, size, m_batchout, NULL, 1, dftsize, planFlags());
+        std::fill(m_batchin, m_batchin+qint64(size)*count, 0.0); // After the planning, which overwrites it
+    }
+    FFTTYPE* batchInput(){
+        return m_batchin;
+    }
+    std::complex<FFTTYPE>* batchOutput(){
+        // fftw_complex and std::complex<double> have the same layout
+        return reinterpret_cast<std::complex<FFTTYPE>*>(m_batchout);
+    }
+    void executeBatch(int count){
+        if(count==m_batch_count){
+            fftw_execute(m_batchplan);
+        }
+        else{
+            // An incomplete batch, frame by frame
+            int dftsize = m_batch_size/2+1;
+            for(int i=0; i<count; ++i){
+                std::copy(m_batchin+qint64(i)*m_batch_size, m_batchin+qint64(i+1)*m_batch_size, m_in);
+                fftw_execute(m_plan);
+                std::copy(m_out[0], m_out[0]+2*dftsize, m_batchout[0]+2*qint64(i)*dftsize);
+            }
+        }
+    }
+    #endif
+
+    ~FFTBackendFFTW3(){
+        clear();
+    }
+};
+#endif
+
+#ifdef FFT_FFTREAL
+// FFTReal ----------------------------------------------------------------------
+
+class FFTBackendFFTReal : public FFTBackend
+{
+    int m_size;
+    ffft::FFTReal<FFTTYPE>* m_fft;
+    std::vector<FFTTYPE> m_f;
+
+public:
+    FFTBackendFFTReal()
+        : m_size(0)
+        , m_fft(NULL)
+    {}
+
+    bool supports(int size) const {
+        return isPowerOfTwo(size) && size>=2;
+    }
+
+    void resize(int size){
+        if(size==m_size)
+            return;
+        delete m_fft;
+        m_size = size;
+        m_fft = new ffft::FFTReal<FFTTYPE>(size);
+        m_f.resize(size);
+    }
+
+    void execute(const FFTTYPE* in, std::complex<FFTTYPE>* out){
+        m_fft->do_fft(&(m_f[0]), in);
+        // f[0,size/2] are the real parts, f[size/2+k] the negative imaginary part of bin k
+        int h = m_size/2;
+        out[0] = m_f[0];
+        for(int k=1; k<h; ++k)
+            out[k] = std::complex<FFTTYPE>(m_f[k], -m_f[h+k]);
+        out[h] = m_f[h];
+    }
+
+    ~FFTBackendFFTReal(){
+        delete m_fft;
+    }
+};
+#endif
+
+// Built-in ---------------------------------------------------------------------
+
+// Radix-2 Stockham FFT on split real and imaginary arrays.
+// The butterflies of each pass run on contiguous arrays, without bit reversal,
+// so that the compilers vectorize them (SSE/AVX/NEON, depending on the target).
+template<typename T>
+class FFTComplexStockham
+{
+    int m_size;
+    std::vector<T> m_wr; // Twiddle factors of all the passes, one after the other
+    std::vector<T> m_wi;
+    std::vector<T> m_tr; // Work buffers
+    std::vector<T> m_ti;
+
+public:
+    FFTComplexStockham() : m_size(0) {}
+
+    void resize(int size){
+        m_size = size;
+        m_tr.resize(size);
+        m_ti.resize(size);
+        m_wr.clear();
+        m_wi.clear();
+        for(int n=size; n>1; n/=2){
+            // Pass of length n: w_p = exp(-i*2*pi*p/n)
+            for(int p=0; p<n/2; ++p){
+                m_wr.push_back(std::cos(2*M_PI*p/n));
+                m_wi.push_back(-std::sin(2*M_PI*p/n));
+            }
+        }
+    }
+
+    // In place, forward (sign=-1) or backward (sign=+1, not normalized)
+    void execute(T* xr, T* xi, int sign=-1){
+        T* ar = xr;
+        T* ai = xi;
+        T* br = &(m_tr[0]);
+        T* bi = &(m_ti[0]);
+        const T* wr = &(m_wr[0]);
+        const T* wi = &(m_wi[0]);
+        T conj = T(-sign);
+        int s = 1; // Stride
+        for(int n=m_size; n>1; n/=2, s*=2){
+            int m = n/2;
+            for(int p=0; p<m; ++p){
+                T cr = wr[p];
+                T ci = conj*wi[p];
+                const T* a0r = ar+s*p;
+                const T* a0i = ai+s*p;
+                const T* a1r = ar+s*(p+m);
+                const T* a1i = ai+s*(p+m);
+                T* b0r = br+s*2*p;
+                T* b0i = bi+s*2*p;
+                T* b1r = br+s*(2*p+1);
+                T* b1i = bi+s*(2*p+1);
+                for(int q=0; q<s; ++q){
+                    T dr = a0r[q] - a1r[q];
+                    T di = a0i[q] - a1i[q];
+                    b0r[q] = a0r[q] + a1r[q];
+                    b0i[q] = a0i[q] + a1i[q];
+                    b1r[q] = dr*cr - di*ci;
+                    b1i[q] = dr*ci + di*cr;
+                }
+            }
+            wr += m;
+            wi += m;
+            std::swap(ar, br);
+            std::swap(ai, bi);
+        }
+        if(ar!=xr){
+            std::copy(ar, ar+m_size, xr);
+            std::copy(ai, ai+m_size, xi);
+        }
+    }
+};
+
+// Real FFT: a complex FFT of half the size for the powers of two,
+// Bluestein's algorithm (chirp z-transform) for the other sizes.
+// (in single or double precision)
+template<typename T>
+class FFTRealBuiltin
+{
+    int m_size;
+    FFTComplexStockham<T> m_cfft;
+    std::vector<T> m_zr;
+    std::vector<T> m_zi;
+    std::vector<T> m_er; // Twiddles of the split of the half-size FFT
+    std::vector<T> m_ei;
+
+    // For Bluestein
+    int m_bsize;
+    std::vector<T> m_chr; // The chirp exp(-i*pi*n^2/size)
+    std::vector<T> m_chi;
+    std::vector<T> m_bfr; // The DFT of its conjugate
+    std::vector<T> m_bfi;
+
+public:
+    FFTRealBuiltin()
+        : m_size(0)
+        , m_bsize(0)
+    {}
+
+    void resize(int size){
+        if(size==m_size)
+            return;
+        m_size = size;
+        if(isPowerOfTwo(size)){
+            int h = size/2;
+            m_cfft.resize(h);
+            m_zr.resize(h);
+            m_zi.resize(h);
+            m_er.resize(h);
+            m_ei.resize(h);
+            for(int k=0; k<h; ++k){
+                m_er[k] = std::cos(2*M_PI*k/size);
+                m_ei[k] = -std::sin(2*M_PI*k/size);
+            }
+        }
+        else{
+            m_bsize = 1;
+            while(m_bsize<2*size-1)
+                m_bsize *= 2;
+            m_cfft.resize(m_bsize);
+            m_zr.resize(m_bsize);
+            m_zi.resize(m_bsize);
+            m_chr.resize(size);
+            m_chi.resize(size);
+            for(int n=0; n<size; ++n){
+                // n^2 modulo 2*size, for the precision of the large n
+                double phi = M_PI*double((qint64(n)*n)%(2*qint64(size)))/size;
+                m_chr[n] = std::cos(phi);
+                m_chi[n] = -std::sin(phi);
+            }
+            m_bfr.assign(m_bsize, 0.0);
+            m_bfi.assign(m_bsize, 0.0);
+            m_bfr[0] = m_chr[0];
+            m_bfi[0] = -m_chi[0];
+            for(int n=1; n<size; ++n){
+                m_bfr[n] = m_bfr[m_bsize-n] = m_chr[n];
+                m_bfi[n] = m_bfi[m_bsize-n] = -m_chi[n];
+            }
+            m_cfft.execute(&(m_bfr[0]), &(m_bfi[0]));
+        }
+    }
+
+    void execute(const T* in, std::complex<T>* out){
+        if(isPowerOfTwo(m_size)){
+            int h = m_size/2;
+            T* zr = &(m_zr[0]);
+            T* zi = &(m_zi[0]);
+            for(int n=0; n<h; ++n){
+                zr[n] = in[2*n];
+                zi[n] = in[2*n+1];
+            }
+            m_cfft.execute(zr, zi);
+            // X[k] = (Z[k]+conj(Z[h-k]))/2 - i/2*e^(-i2pik/size)*(Z[k]-conj(Z[h-k]))
+            out[0] = zr[0]+zi[0];
+            out[h] = zr[0]-zi[0];
+            for(int k=1; k<h; ++k){
+                T evr = T(0.5)*(zr[k]+zr[h-k]);
+                T evi = T(0.5)*(zi[k]-zi[h-k]);
+                T odr = T(0.5)*(zi[k]+zi[h-k]);
+                T odi = T(-0.5)*(zr[k]-zr[h-k]);
+                out[k] = std::complex<T>(evr + m_er[k]*odr - m_ei[k]*odi,
+                                         evi + m_er[k]*odi + m_ei[k]*odr);
+            }
+        }
+        else{
+            T* zr = &(m_zr[0]);
+            T* zi = &(m_zi[0]);
+            for(int n=0; n<m_size; ++n){
+                zr[n] = in[n]*m_chr[n];
+                zi[n] = in[n]*m_chi[n];
+            }
+            std::fill(zr+m_size, zr+m_bsize, 0.0);
+            std::fill(zi+m_size, zi+m_bsize, 0.0);
+            m_cfft.execute(zr, zi);
+            for(int n=0; n<m_bsize; ++n){
+                T r = zr[n]*m_bfr[n] - zi[n]*m_bfi[n];
+                zi[n] = zr[n]*m_bfi[n] + zi[n]*m_bfr[n];
+                zr[n] = r;
+            }
+            m_cfft.execute(zr, zi, +1);
+            for(int k=0; k<m_size/2+1; ++k){
+                T r = (zr[k]*m_chr[k] - zi[k]*m_chi[k])/m_bsize;
+                T i = (zr[k]*m_chi[k] + zi[k]*m_chr[k])/m_bsize;
+                out[k] = std::complex<T>(r, i);
+            }
+        }
+    }
+};
+
+class FFTBackendBuiltin : public FFTBackend
+{
+    int m_size;
+    FFTRealBuiltin<FFTTYPE> m_fft;
+
+    // The complex DFT of the pairs of frames (powers of two only)
+    int m_pairsize;
+    FFTComplexStockham<FFTTYPE> m_pairfft;
+    std::vector<FFTTYPE> m_pairr;
+    std::vector<FFTTYPE> m_pairi;
+
+public:
+    FFTBackendBuiltin()
+        : m_size(0)
+        , m_pairsize(0)
+    {}
+
+    bool supports(int size) const {
+        return size>=2;
+    }
+    void resize(int size){
+        m_fft.resize(size);
+        m_size = size;
+    }
+    void execute(const FFTTYPE* in, std::complex<FFTTYPE>* out){
+        m_fft.execute(in, out);
+    }
+
+    void preparePair(int size){
+        if(!isPowerOfTwo(size) || size==m_pairsize)
+            return;
+        m_pairfft.resize(size);
+        m_pairr.resize(size);
+        m_pairi.resize(size);
+        m_pairsize = size;
+    }
+    void executePair(const FFTTYPE* x, const FFTTYPE* y, std::complex<FFTTYPE>* xout, std::complex<FFTTYPE>* yout){
+        if(m_pairsize!=m_size){
+            // Bluestein's algorithm costs more than two real DFTs
+            FFTBackend::executePair(x, y, xout, yout);
+            return;
+        }
+        std::copy(x, x+m_size, m_pairr.begin());
+        std::copy(y, y+m_size, m_pairi.begin());
+        m_pairfft.execute(&(m_pairr[0]), &(m_pairi[0]));
+        separatePair(&(m_pairr[0]), &(m_pairi[0]), 1, m_size, xout, yout);
+    }
+};
+
+// Selection --------------------------------------------------------------------
+
+// The kinds of sizes, which the backends don't handle equally well
+// (e.g. FFTReal can do only the powers of two, the built-in FFT uses
+// Bluestein's algorithm for the others)
+enum SizeKind {SKPowerOfTwo=0, SKEven=1, SKOdd=2, SKNumber=3};
+
+static QMutex s_best_mutex;
+static int s_best[SKNumber][32]; // The backend for each kind of sizes in ]2^(i-1),2^i]
+static bool s_best_measured = false;
+
+static inline int sizeRange(int size) {
+    int i = 0;
+    while((1<<i)<size && i<31)
+        ++i;
+    return i;
+}
+
+static inline int sizeKind(int size) {
+    if(isPowerOfTwo(size))
+        return SKPowerOfTwo;
+    return (size%2==0)?SKEven:SKOdd;
+}
+
+// The size measured for each kind in ]2^(r-1),2^r]
+static inline int benchmarkSize(int kind, int r) {
+    if(kind==SKPowerOfTwo)
+        return 1<<r;
+    else if(kind==SKEven)
+        return 3<<(r-2);
+    return (1<<r)-1;
+}
+
+bool FFTBackend::isAvailable(int type) {
+    #ifdef FFT_FFTW3
+        if(type==FBFFTW3) return true;
+    #endif
+    #ifdef FFT_FFTREAL
+        if(type==FBFFTReal) return true;
+    #endif
+    return type==FBBuiltin;
+}
+
+QString FFTBackend::name(int type) {
+    if(type==FBFFTW3)   return "FFTW3";
+    if(type==FBFFTReal) return "FFTReal";
+    if(type==FBBuiltin) return "Built-in";
+    return "";
+}
+
+FFTBackend* FFTBackend::create(int type) {
+    #ifdef FFT_FFTW3
+        if(type==FBFFTW3) return new FFTBackendFFTW3();
+    #endif
+    #ifdef FFT_FFTREAL
+        if(type==FBFFTReal) return new FFTBackendFFTReal();
+    #endif
+    Q_UNUSED(type)
+    return new FFTBackendBuiltin();
+}
+
+void FFTBackend::setTimeLimitForPlanPreparation(double t) {
+    #ifdef FFT_FFTW3
+        s_fftw3_timelimit = t;
+    #else
+        Q_UNUSED(t)
+    #endif
+}
+
+void FFTBackend::benchmark() {
+    // From 64 to 65536
+    const int rmin = 6;
+    const int rmax = 16;
+
+    // The sizes which are not measured use FFTW3, if available
+    int best[SKNumber][32];
+    for(int kind=0; kind<SKNumber; ++kind)
+        for(int r=0; r<32; ++r)
+            best[kind][r] = isAvailable(FBFFTW3)?FBFFTW3:FBBuiltin;
+
+    std::vector<FFTTYPE> in(1<<rmax);
+    std::vector<std::complex<FFTTYPE> > out((1<<rmax)/2+1);
+    for(size_t n=0; n<in.size(); ++n)
+        in[n] = std::sin(0.1*n)+0.01*(n%7);
+
+    for(int kind=0; kind<SKNumber; ++kind){
+        for(int r=rmin; r<=rmax; ++r){
+            int size = benchmarkSize(kind, r);
+            qint64 besttime = -1;
+            for(int type=0; type<FBNumber; ++type){
+                if(!isAvailable(type))
+                    continue;
+                FFTBackend* backend = create(type);
+                if(!backend->supports(size)){
+                    delete backend;
+                    continue;
+                }
+                backend->resize(size); // With the plans used afterwards (see setTimeLimitForPlanPreparation())
+                backend->execute(&(in[0]), &(out[0])); // Warm up
+
+                // The best of a few runs of ~1ms
+                int nbruns = std::max(1, (1<<18)/size);
+                qint64 time = -1;
+                for(int trial=0; trial<3; ++trial){
+                    QElapsedTimer timer;
+                    timer.start();
+                    for(int run=0; run<nbruns; ++run)
+                        backend->execute(&(in[0]), &(out[0]));
+                    qint64 elapsed = timer.nsecsElapsed();
+                    if(time<0 || elapsed<time)
+                        time = elapsed;
+                }
+                delete backend;
+
+                if(besttime<0 || time<besttime){
+                    besttime = time;
+                    best[kind][r] = type;
+                }
+            }
+        }
+    }
+
+    s_best_mutex.lock();
+    for(int kind=0; kind<SKNumber; ++kind)
+        std::copy(best[kind], best[kind]+32, s_best[kind]);
+    s_best_measured = true;
+    s_best_mutex.unlock();
+}
+
+int FFTBackend::best(int size) {
+    s_best_mutex.lock();
+    int type = FBBuiltin;
+    if(s_best_measured)
+        type = s_best[sizeKind(size)][sizeRange(size)];
+    else if(isAvailable(FBFFTW3))
+        type = FBFFTW3;
+    s_best_mutex.unlock();
+
+    // FFTReal can do only the powers of two
+    FFTBackend* backend = create(type);
+    if(!backend->supports(size))
+        type = isAvailable(FBFFTW3)?FBFFTW3:FBBuiltin;
+    delete backend;
+
+    return type;
+}
+
+// The contiguous size ranges using the same backend
+static QString rangesInfo(const int* best) {
+    QStringList ranges;
+    int rbegin = 0;
+    for(int r=1; r<=32; ++r){
+        if(r<32 && best[r]==best[rbegin])
+            continue;
+        QString range = FFTBackend::name(best[rbegin]);
+        if(rbegin>0 && r<32)
+            range += " for "+QString::number((qint64(1)<<(rbegin-1))+1)+"-"+QString::number(qint64(1)<<(r-1));
+        else if(rbegin>0)
+            range += " above "+QString::number(qint64(1)<<(rbegin-1));
+        else if(r<32)
+            range += " up to "+QString::number(qint64(1)<<(r-1));
+        ranges.append(range);
+        rbegin = r;
+    }
+    return ranges.join(", ");
+}
+
+QString FFTBackend::info() {
+    QStringList available;
+    for(int type=0; type<FBNumber; ++type)
+        if(isAvailable(type))
+            available.append(name(type));
+    QString str = available.join(", ");
+
+    s_best_mutex.lock();
+    if(s_best_measured){
+        str += " (used: "+rangesInfo(s_best[SKPowerOfTwo])+" for the powers of two; ";
+        str += rangesInfo(s_best[SKEven])+" for the other even sizes; ";
+        str += rangesInfo(s_best[SKOdd])+" for the odd sizes)";
+    }
+    s_best_mutex.unlock();
+
+    return str;
+}
+
+// FFTTransformer ---------------------------------------------------------------
+
+FFTTransformer::FFTTransformer()
+    : m_backend(NULL)
+    , m_backend_type(-1)
+    , m_size(0)
+    , m_batchsize(0)
+{
+}
+
+void FFTTransformer::resize(int size, int batchsize) {
+    if(size==m_size && batchsize==m_batchsize)
+        return;
+
+    if(size!=m_size){
+        int type = FFTBackend::best(size);
+        if(type!=m_backend_type){
+            delete m_backend;
+            m_backend = FFTBackend::create(type);
+            m_backend_type = type;
+        }
+        m_backend->resize(size);
+        m_size = size;
+        in.assign(size, 0.0);
+        out.resize(size/2+1);
+        in2.clear(); // The pairs have to be prepared again
+        out2.clear();
+    }
+    m_backend->prepareBatch(size, batchsize);
+    m_batchsize = batchsize;
+}
+
+void FFTTransformer::preparePair() {
+    if(int(in2.size())==m_size)
+        return;
+    m_backend->preparePair(m_size);
+    in2.assign(m_size, 0.0);
+    out2.resize(m_size/2+1);
+}
+
+FFTTransformer::~FFTTransformer() {
+    delete m_backend;
+}
+
+// FFTTransformerFloat ----------------------------------------------------------
+
+#ifdef FFT_FFTW3
+
+class FFTTransformerFloat::Backend
+{
+    int m_size;
+    int m_count;
+    float* m_in;
+    fftwf_complex* m_out;
+    fftwf_plan m_plan;      // For the whole batch
+    fftwf_plan m_planframe; // For the frames of incomplete batches
+
+public:
+    Backend(int size, int count)
+        : m_size(size)
+        , m_count(count)
+    {
+        m_in = (float*)fftwf_malloc(sizeof(float)*size*count);
+        m_out = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex)*(size/2+1)*count);
+        unsigned int flags = FFTW_ESTIMATE;
+        if(s_fftw3_timelimit>0.0){
+            fftwf_set_timelimit(s_fftw3_timelimit);
+            flags = FFTW_MEASURE; // As FFTBackendFFTW3::planFlags()
+        }
+        m_plan = fftwf_plan_many_dft_r2c(1, &size, count, m_in, NULL, 1, size, m_out, NULL, 1, size/2+1, flags);
+        m_planframe = fftwf_plan_dft_r2c_1d(size, m_in, m_out, flags|FFTW_UNALIGNED);
+        std::fill(m_in, m_in+qint64(size)*count, 0.0f);
+    }
+    inline float* in() {return m_in;}
+    inline std::complex<float>* out() {return reinterpret_cast<std::complex<float>*>(m_out);}
+    void execute(int count){
+        if(count==m_count)
+            fftwf_execute(m_plan);
+        else
+            for(int i=0; i<count; ++i)
+                fftwf_execute_dft_r2c(m_planframe, m_in+qint64(i)*m_size, m_out+qint64(i)*(m_size/2+1));
+    }
+    ~Backend(){
+        fftwf_destroy_plan(m_planframe);
+        fftwf_destroy_plan(m_plan);
+        fftwf_free(m_in);
+        fftwf_free(m_out);
+    }
+};
+
+#else
+
+class FFTTransformerFloat::Backend
+{
+    int m_size;
+    FFTRealBuiltin<float> m_fft;
+    std::vector<float> m_in;
+    std::vector<std::complex<float> > m_out;
+
+public:
+    Backend(int size, int count)
+        : m_size(size)
+    {
+        m_fft.resize(size);
+        m_in.assign(qint64(size)*count, 0.0f);
+        m_out.resize(qint64(size/2+1)*count);
+    }
+    inline float* in() {return &(m_in[0]);}
+    inline std::complex<float>* out() {return &(m_out[0]);}
+    void execute(int count){
+        for(int i=0; i<count; ++i)
+            m_fft.execute(&(m_in[0])+qint64(i)*m_size, &(m_out[0])+qint64(i)*(m_size/2+1));
+    }
+};
+
+#endif
+
+FFTTransformerFloat::FFTTransformerFloat()
+    : m_backend(NULL)
+    , m_size(0)
+    , m_batchsize(0)
+    , m_in(NULL)
+    , m_out(NULL)
+{
+}
+
+void FFTTransformerFloat::resize(int size, int batchsize) {
+    if(size==m_size && batchsize==m_batchsize)
+        return;
+
+    delete m_backend;
+    m_backend = new Backend(size, batchsize);
+    m_size = size;
+    m_batchsize = batchsize;
+    m_in = m_backend->in();
+    m_out = m_backend->out();
+}
+
+void FFTTransformerFloat::executeBatch(int count) {
+    m_backend->execute(count);
+}
+
+FFTTransformerFloat::~FFTTransformerFloat() {
+    delete m_backend;
+}
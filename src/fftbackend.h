@@ -0,0 +1,144 @@
+/*
+Copyright (C) 2015  Gilles Degottex <gilles.degottex@gmail.com>
+
+This file is part of DFasma.
+
+DFasma is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DFasma is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available in the LICENSE.txt
+file provided in the source code of DFasma. Another copy can be found at
+<http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FFTBACKEND_H
+#define FFTBACKEND_H
+
+#include <vector>
+#include <complex>
+
+#include <QString>
+
+#include "qaesigproc.h"
+
+// An implementation of the forward DFT of a real signal.
+// The available implementations are timed at startup, and the fastest one
+// is then used for each range of sizes (see FFTBackend::benchmark()).
+class FFTBackend
+{
+protected:
+    // The batch of frames, one after the other (size and size/2+1 values per frame)
+    int m_batch_size;
+    int m_batch_count;
+    std::vector<FFTTYPE> m_batch_in;
+    std::vector<std::complex<FFTTYPE> > m_batch_out;
+
+public:
+    enum Type {FBFFTW3=0, FBFFTReal=1, FBBuiltin=2, FBNumber=3};
+
+    FFTBackend() : m_batch_size(0), m_batch_count(0) {}
+    virtual ~FFTBackend(){}
+
+    virtual bool supports(int size) const = 0;
+    virtual void resize(int size) = 0; // Prepare the plan and the buffers
+    // out[k] for k in [0,size/2] (in is left unchanged)
+    virtual void execute(const FFTTYPE* in, std::complex<FFTTYPE>* out) = 0;
+
+    // The transforms of several frames at once (after resize())
+    virtual void prepareBatch(int size, int count);
+    virtual FFTTYPE* batchInput() {return &(m_batch_in[0]);}
+    virtual std::complex<FFTTYPE>* batchOutput() {return &(m_batch_out[0]);}
+    virtual void executeBatch(int count); // The first count frames of the batch
+
+    // The transforms of two frames at once, through one complex DFT of x+iy (after preparePair())
+    virtual void preparePair(int size) {Q_UNUSED(size);}
+    virtual void executePair(const FFTTYPE* x, const FFTTYPE* y, std::complex<FFTTYPE>* xout, std::complex<FFTTYPE>* yout);
+
+    static bool isAvailable(int type);
+    static QString name(int type);
+    static FFTBackend* create(int type);
+
+    // Time the available backends and choose the fastest one for each size range,
+    // for the powers of two, the other even sizes and the odd sizes (the other sizes use FFTW3).
+    // Called once the time limit is set, so that the plans are the ones used afterwards.
+    static void benchmark();
+    // The backend to use for this size (according to the benchmark)
+    static int best(int size);
+    static QString info();
+
+    static void setTimeLimitForPlanPreparation(double t); // [s] (for FFTW3)
+};
+
+// The FFT transformer used by the views, with the same interface as qae::FFTwrapper,
+// but using the fastest backend for its size.
+class FFTTransformer
+{
+    FFTBackend* m_backend;
+    int m_backend_type;
+    int m_size;
+    int m_batchsize;
+
+public:
+    FFTTransformer();
+
+    std::vector<FFTTYPE> in;                    // [size] (zero-padded by the user)
+    std::vector<std::complex<FFTTYPE> > out;    // [size/2+1]
+
+    void resize(int size, int batchsize=1);
+    inline int size() const {return m_size;}
+    inline int batchSize() const {return m_batchsize;}
+    inline int backendType() const {return m_backend_type;}
+
+    inline void setInput(int n, FFTTYPE value) {in[n] = value;}
+    inline void execute() {m_backend->execute(&(in[0]), &(out[0]));}
+    inline FFTTYPE getDCOutput() const {return out[0].real();}
+    inline const std::complex<FFTTYPE>& getMidOutput(int n) const {return out[n];}
+    inline FFTTYPE getNyquistOutput() const {return out[m_size/2].real();}
+
+    // Batch of frames, in contiguous (and aligned, with FFTW3) buffers
+    inline FFTTYPE* batchInput(int i) {return m_backend->batchInput()+qint64(i)*m_size;}
+    inline const std::complex<FFTTYPE>* batchOutput(int i) {return m_backend->batchOutput()+qint64(i)*(m_size/2+1);}
+    inline void executeBatch(int count) {m_backend->executeBatch(count);}
+
+    // Two frames at once: in and in2 giving out and out2
+    std::vector<FFTTYPE> in2;                   // [size] (after preparePair())
+    std::vector<std::complex<FFTTYPE> > out2;   // [size/2+1]
+    void preparePair();
+    inline void executePair() {m_backend->executePair(&(in[0]), &(in2[0]), &(out[0]), &(out2[0]));}
+
+    ~FFTTransformer();
+};
+
+// The single precision DFTs of batches of frames, for the display of the spectrogram
+// (with FFTW3's single precision plans if available, the built-in FFT otherwise).
+class FFTTransformerFloat
+{
+    class Backend;
+    Backend* m_backend;
+    int m_size;
+    int m_batchsize;
+    float* m_in;
+    std::complex<float>* m_out;
+
+public:
+    FFTTransformerFloat();
+
+    void resize(int size, int batchsize);
+    inline int size() const {return m_size;}
+    inline int batchSize() const {return m_batchsize;}
+
+    inline float* batchInput(int i) {return m_in+qint64(i)*m_size;}
+    inline const std::complex<float>* batchOutput(int i) {return m_out+qint64(i)*(m_size/2+1);}
+    void executeBatch(int count);
+
+    ~FFTTransformerFloat();
+};
+
+#endif // FFTBACKEND_H
@@ -0,0 +1,226 @@
+/*
+Copyright (C) 2015  Gilles Degottex <gilles.degottex@gmail.com>
+
+This file is part of DFasma.
+
+DFasma is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DFasma is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available in the LICENSE.txt
+file provided in the source code of DFasma. Another copy can be found at
+<http://www.gnu.org/licenses/>.
+*/
+
+#include "fftplancache.h"
+
+#include <list>
+
+#include <QMutex>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QCoreApplication>
+
+#ifdef FFT_FFTW3
+    #include <fftw3.h>
+#endif
+
+class FFTPlan{
+public:
+    enum Kind {FPWrapper, FPTransformer, FPTransformerFloat};
+
+    int kind;
+    qae::FFTwrapper* wrapper;       // One of the three, according to kind
+    FFTTransformer* transformer;
+    FFTTransformerFloat* transformerf;
+    int size;
+    int batchsize;
+    bool forward;
+
+    FFTPlan(int reqkind, int reqsize, int reqbatchsize, bool reqforward=true)
+        : kind(reqkind)
+        , wrapper(NULL)
+        , transformer(NULL)
+        , transformerf(NULL)
+        , size(reqsize)
+        , batchsize(reqbatchsize)
+        , forward(reqforward)
+    {}
+
+    inline qint64 planSize() const { // Approximation of the memory taken (input, output and plan buffers) [bytes]
+        qint64 valuesize = (kind==FPTransformerFloat)?sizeof(float):sizeof(FFTTYPE);
+        return 3*qint64(size)*qint64(batchsize+1)*valuesize;
+    }
+    void clear() {
+        delete wrapper;
+        delete transformer;
+        delete transformerf;
+    }
+};
+
+static QMutex s_plans_mutex;            // Protects the plans, and serializes the plan preparations
+static std::list<FFTPlan> s_plans;      // Most recently used first
+static qint64 s_plans_size = 0;         // [bytes]
+static const qint64 s_plans_limit = 64*1024*1024; // [bytes]
+
+// Removes the plan from the cache and returns it, if it's there.
+// Assumes s_plans_mutex is locked.
+static bool takePlan(FFTPlan& plan) {
+    std::list<FFTPlan>::iterator it=s_plans.begin();
+    while(it!=s_plans.end()
+          && (it->kind!=plan.kind || it->size!=plan.size || it->batchsize!=plan.batchsize || it->forward!=plan.forward))
+        ++it;
+    if(it==s_plans.end())
+        return false;
+
+    plan = *it;
+    s_plans_size -= it->planSize();
+    s_plans.erase(it);
+    return true;
+}
+
+static void givePlan(const FFTPlan& plan) {
+    if(plan.size<=0){
+        FFTPlan(plan).clear(); // Never prepared
+        return;
+    }
+
+    s_plans_mutex.lock();
+
+    s_plans.push_front(plan);
+    s_plans_size += plan.planSize();
+
+    // Drop the least recently used ones
+    while(s_plans_size>s_plans_limit && !s_plans.empty()){
+        s_plans_size -= s_plans.back().planSize();
+        s_plans.back().clear();
+        s_plans.pop_back();
+    }
+
+    s_plans_mutex.unlock();
+}
+
+void FFTPlanCache::give(qae::FFTwrapper* fft, bool forward) {
+    if(fft==NULL)
+        return;
+    FFTPlan plan(FFTPlan::FPWrapper, fft->size(), 0, forward);
+    plan.wrapper = fft;
+    givePlan(plan);
+}
+
+void FFTPlanCache::give(FFTTransformer* fft) {
+    if(fft==NULL)
+        return;
+    FFTPlan plan(FFTPlan::FPTransformer, fft->size(), fft->batchSize());
+    plan.transformer = fft;
+    givePlan(plan);
+}
+
+void FFTPlanCache::give(FFTTransformerFloat* fft) {
+    if(fft==NULL)
+        return;
+    FFTPlan plan(FFTPlan::FPTransformerFloat, fft->size(), fft->batchSize());
+    plan.transformerf = fft;
+    givePlan(plan);
+}
+
+void FFTPlanCache::resize(qae::FFTwrapper*& fft, int size, bool forward) {
+    if(fft && fft->size()==size)
+        return;
+
+    FFTPlan plan(FFTPlan::FPWrapper, size, 0, forward);
+    s_plans_mutex.lock();
+    if(!takePlan(plan)){
+        plan.wrapper = new qae::FFTwrapper(forward);
+        plan.wrapper->resize(size);
+    }
+    s_plans_mutex.unlock();
+
+    give(fft, forward);
+    fft = plan.wrapper;
+}
+
+void FFTPlanCache::resize(FFTTransformer*& fft, int size, int batchsize) {
+    if(fft && fft->size()==size && fft->batchSize()==batchsize)
+        return;
+
+    FFTPlan plan(FFTPlan::FPTransformer, size, batchsize);
+    s_plans_mutex.lock();
+    if(!takePlan(plan)){
+        plan.transformer = new FFTTransformer();
+        plan.transformer->resize(size, batchsize);
+    }
+    s_plans_mutex.unlock();
+
+    give(fft);
+    fft = plan.transformer;
+}
+
+void FFTPlanCache::resize(FFTTransformerFloat*& fft, int size, int batchsize) {
+    if(fft && fft->size()==size && fft->batchSize()==batchsize)
+        return;
+
+    FFTPlan plan(FFTPlan::FPTransformerFloat, size, batchsize);
+    s_plans_mutex.lock();
+    if(!takePlan(plan)){
+        plan.transformerf = new FFTTransformerFloat();
+        plan.transformerf->resize(size, batchsize);
+    }
+    s_plans_mutex.unlock();
+
+    give(fft);
+    fft = plan.transformerf;
+}
+
+void FFTPlanCache::preparePair(FFTTransformer* fft) {
+    if(fft==NULL)
+        return;
+
+    s_plans_mutex.lock();
+    fft->preparePair(); // Immediate if already prepared for this size
+    s_plans_mutex.unlock();
+}
+
+void FFTPlanCache::clear() {
+    s_plans_mutex.lock();
+    for(std::list<FFTPlan>::iterator it=s_plans.begin(); it!=s_plans.end(); ++it)
+        it->clear();
+    s_plans.clear();
+    s_plans_size = 0;
+    s_plans_mutex.unlock();
+}
+
+// Next to the settings file
+QString FFTPlanCache::wisdomFilePath() {
+    return QStandardPaths::writableLocation(QStandardPaths::ConfigLocation)+"/"+QCoreApplication::organizationName()+"/fftw3.wisdom";
+}
+
+void FFTPlanCache::loadWisdom() {
+    #ifdef FFT_FFTW3
+        QString filepath = wisdomFilePath();
+        if(!QFile::exists(filepath))
+            return;
+        s_plans_mutex.lock();
+        fftw_import_wisdom_from_filename(QFile::encodeName(filepath).constData());
+        s_plans_mutex.unlock();
+    #endif
+}
+
+void FFTPlanCache::saveWisdom() {
+    #ifdef FFT_FFTW3
+        QString filepath = wisdomFilePath();
+        if(!QDir().mkpath(QFileInfo(filepath).absolutePath()))
+            return;
+        s_plans_mutex.lock();
+        fftw_export_wisdom_to_filename(QFile::encodeName(filepath).constData());
+        s_plans_mutex.unlock();
+    #endif
+}
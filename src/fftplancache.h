@@ -0,0 +1,60 @@
+/*
+Copyright (C) 2015  Gilles Degottex <gilles.degottex@gmail.com>
+
+This file is part of DFasma.
+
+DFasma is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DFasma is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available in the LICENSE.txt
+file provided in the source code of DFasma. Another copy can be found at
+<http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FFTPLANCACHE_H
+#define FFTPLANCACHE_H
+
+#include <QString>
+
+#include "qaesigproc.h"
+#include "fftbackend.h"
+
+// Keeps the FFT transformers which are not used anymore, with their plans
+// and buffers ready, so that going back to a previous size is immediate.
+// Shared by the spectrum and the spectrogram (thread-safe).
+// Both the transformers of the FFT backends and the ones of libqaudioextra
+// (used by the cepstral functions) are kept.
+// With FFTW3, the wisdom is also saved on exit and loaded at startup,
+// so that the plans, measured (see FFTBackend), are quickly ready again
+// from one session to the next.
+class FFTPlanCache
+{
+public:
+    // Resizes fft if necessary, by exchanging it with one from the cache
+    // (fft can be NULL, a new one is then created if the cache has none)
+    static void resize(qae::FFTwrapper*& fft, int size, bool forward=true);
+    // (batchsize: the number of frames which can be transformed at once)
+    static void resize(FFTTransformer*& fft, int size, int batchsize=1);
+    static void resize(FFTTransformerFloat*& fft, int size, int batchsize);
+    // Prepares the transforms of pairs of frames (see FFTTransformer::preparePair())
+    static void preparePair(FFTTransformer* fft);
+    // Gives back a transformer which is not used anymore (can be NULL)
+    static void give(qae::FFTwrapper* fft, bool forward=true);
+    static void give(FFTTransformer* fft);
+    static void give(FFTTransformerFloat* fft);
+
+    static void clear();
+
+    static QString wisdomFilePath();
+    static void loadWisdom();
+    static void saveWisdom();
+};
+
+#endif // FFTPLANCACHE_H
@@ -32,6 +32,7 @@ using namespace std;
 #include <QFileInfo>
 #include <QGraphicsRectItem>
 #include <QProgressDialog>
+#include <QCryptographicHash>
 #include "wmainwindow.h"
 #include "ui_wmainwindow.h"
 #include "gvspectrumamplitude.h"
@@ -55,7 +56,7 @@ double FTSound::s_fs_common = 0; // Initially, fs is undefined
 WAVTYPE FTSound::s_play_power = 0;
 std::deque<WAVTYPE> FTSound::s_play_power_values;
 
-FTSound::DFTParameters::DFTParameters(unsigned int _nl, unsigned int _nr, int _winlen, int _wintype, int _normtype, const std::vector<FFTTYPE>& _win, int _dftlen, std::vector<FFTTYPE>*_wav, qreal _ampscale, qint64 _delay){
+FTSound::DFTParameters::DFTParameters(unsigned int _nl, unsigned int _nr, int _winlen, int _wintype, int _normtype, const WindowCache::Window& _win, int _dftlen, std::vector<FFTTYPE>*_wav, qreal _ampscale, qint64 _delay){
     clear();
 
     nl = _nl;
@@ -74,11 +75,7 @@ FTSound::DFTParameters::DFTParameters(unsigned int _nl, unsigned int _nr, int _w
 FTSound::DFTParameters& FTSound::DFTParameters::operator=(const DFTParameters &params) {
     nl = params.nl;
     nr = params.nr;
-    if(params.wintype>7      // TODO Replace with a Shape Parameters structure
-       || !(wintype==params.wintype
-            && normtype==params.normtype
-            && winlen==params.winlen))
-        win = params.win;
+    win = params.win; // Only the reference to the cached window is copied
     winlen = params.winlen;
     wintype = params.wintype;
     normtype = params.normtype;
@@ -87,6 +84,8 @@ FTSound::DFTParameters& FTSound::DFTParameters::operator=(const DFTParameters &p
     wav = params.wav;
     ampscale = params.ampscale;
     delay = params.delay;
+    amponly = params.amponly;
+    interpolated = params.interpolated;
 
     return *this;
 }
@@ -107,21 +106,16 @@ bool FTSound::DFTParameters::operator==(const DFTParameters& param) const {
         return false;
     if(dftlen!=param.dftlen)
         return false;
-    if(wintype>7){ // If this is a parametrizable window, check every sample // TODO 7
-        if(win.size()!=param.win.size())
-            return false;
-        for(size_t n=0; n<win.size(); n++)
-            if(win[n]!=param.win[n])
-                return false;
-    }
+    if(win!=param.win) // Same parameters, including the shape ones, give the same cached window
+        return false;
 
     return true;
 }
 
 
 void FTSound::constructor_internal() {
-    m_imgSTFT = QImage(1, 1, QImage::Format_ARGB32);
-    m_imgSTFT.fill(Qt::white);
+    m_imgSTFT.resize(1, 1);
+    m_imgSTFT.fill(qRgb(255, 255, 255));
 
     m_giWavForWaveform = NULL;
     m_channelid = 0;
@@ -138,7 +132,6 @@ void FTSound::constructor_internal() {
 
     m_energpersample = -1.0;
 
-    m_stftpa = NULL;
     m_stft_min = std::numeric_limits<FFTTYPE>::infinity();
     m_stft_max = -std::numeric_limits<FFTTYPE>::infinity();
 
@@ -240,6 +233,7 @@ FTSound::FTSound(const FTSound& ft)
 
     m_giSQNRForSpectrumAmplitude->setPos(0.0, 20*std::log10(std::pow(2.0,m_fileaudioformat.sampleSize())));
 
+    m_wavhash = ft.m_wavhash;
     m_lastreadtime = ft.m_lastreadtime;
     m_modifiedtime = ft.m_modifiedtime;
 
@@ -254,6 +248,16 @@ void FTSound::load_finalize() {
 
     m_giSQNRForSpectrumAmplitude->setPos(0.0, 20*std::log10(std::pow(2.0,m_fileaudioformat.sampleSize())));
 
+    // Hash the waveform for the STFT cache, once per load
+    // (so that the compute thread never has to write it)
+    QCryptographicHash wavhash(QCryptographicHash::Sha1);
+    const qint64 chunksize = 1024*1024; // [samples]
+    for(qint64 n=0; n<qint64(wav.size()); n+=chunksize){
+        qint64 len = std::min(chunksize, qint64(wav.size())-n);
+        wavhash.addData((const char*)&(wav[n]), int(len*sizeof(WAVTYPE)));
+    }
+    m_wavhash = wavhash.result();
+
     m_lastreadtime = QDateTime::currentDateTime();
     needDFTUpdate();
     setStatus();
@@ -326,6 +330,7 @@ bool FTSound::reload() {
 
     stopPlay();
     gMW->m_gvSpectrogram->m_stftcomputethread->cancelComputation(this);
+    gMW->m_gvSpectrumAmplitude->m_dftcomputethread->cancelComputation(this);
 
     if(!checkFileStatus(CFSMMESSAGEBOX))
         return false;
@@ -343,12 +348,11 @@ bool FTSound::reload() {
     wavfiltered.clear();
     setFiltered(false);
     gMW->m_gvSpectrogram->m_stftcomputethread->m_mutex_changingstft.lock();
-//    m_stft.clear();
-    if(m_stftpa){
-        delete m_stftpa;
-        m_stftpa = NULL;
-    }
+    m_imgSTFT.releaseSource();
+    m_stft.clear();
     m_stftts.clear();
+    m_wavhash.clear();
+    m_stftkey.clear();
     gMW->m_gvSpectrogram->m_stftcomputethread->m_mutex_changingstft.unlock();
     m_imgSTFTParams.clear();
     m_stftparams.clear();
@@ -673,6 +677,7 @@ double FTSound::setPlay(const QAudioFormat& format, double tstart, double tstop,
     if ((fstart<fstop) && (doLowPass || doHighPass)) {
         // Filtered play
         try{
+            gMW->m_gvSpectrumAmplitude->m_dftcomputethread->cancelComputation(this); // It might be reading wavfiltered
             wavfiltered = wav; // Is it acceptable for big files ? Reason of issue #117 also ?
 
             // Compute the energy of the non-filtered signal
@@ -922,7 +927,9 @@ FTSound::~FTSound(){
 
     stopPlay();
     if(gMW->m_gvSpectrogram)
-        gMW->m_gvSpectrogram->m_stftcomputethread->cancelComputation(this, true);
+        gMW->m_gvSpectrogram->m_stftcomputethread->cancelComputation(this);
+    if(gMW->m_gvSpectrumAmplitude)
+        gMW->m_gvSpectrumAmplitude->m_dftcomputethread->cancelComputation(this);
     QIODevice::close();
 
     delete m_giWavForWaveform;
@@ -932,11 +939,6 @@ FTSound::~FTSound(){
 
     gFL->ftsnds.erase(std::find(gFL->ftsnds.begin(), gFL->ftsnds.end(), this));
 
-    if(m_stftpa){
-        delete m_stftpa;
-        m_stftpa = NULL;
-    }
-
     delete m_actionResetFiltering;
     delete m_actionResetDelay;
     delete m_actionResetAmpScale;
@@ -33,6 +33,9 @@ file provided in the source code of DFasma. Another copy can be found at
 
 #include "filetype.h"
 #include "stftcomputethread.h"
+#include "stftimage.h"
+#include "stftstorage.h"
+#include "windowcache.h"
 
 #include "qaegiuniformlysampledsignal.h"
 
@@ -101,13 +104,15 @@ public:
         int winlen;
         int wintype;
         int normtype;
-        std::vector<FFTTYPE> win; // Could avoid this by using classes of windows parameters
+        WindowCache::Window win; // Shared by the cache (compared by address)
         int dftlen;
 
         // Sound specific parameters
         std::vector<WAVTYPE>* wav; // The used wav to compute the DFT on.
         WAVTYPE ampscale; // [linear]
         qint64 delay;   // [sample index]
+        bool amponly;   // Only the amplitude spectrum is computed (taken from the STFT)
+        bool interpolated; // ... and interpolated between two STFT frames
 
         void clear(){
             nl = 0;
@@ -115,17 +120,19 @@ public:
             winlen = 0;
             wintype = -1;
             normtype = -1;
-            win.clear();
+            win = WindowCache::Window();
             dftlen = 0;
             wav = NULL;
             ampscale = 1.0;
             delay = 0;
+            amponly = false;
+            interpolated = false;
         }
 
         DFTParameters(){
             clear();
         }
-        DFTParameters(unsigned int _nl, unsigned int _nr, int _winlen, int _wintype, int _normtype, const std::vector<FFTTYPE>& _win=std::vector<FFTTYPE>(), int _dftlen=0, std::vector<FFTTYPE>* _wav=NULL, qreal _ampscale=1.0, qint64 _delay=0);
+        DFTParameters(unsigned int _nl, unsigned int _nr, int _winlen, int _wintype, int _normtype, const WindowCache::Window& _win=WindowCache::Window(), int _dftlen=0, std::vector<FFTTYPE>* _wav=NULL, qreal _ampscale=1.0, qint64 _delay=0);
 
         DFTParameters& operator=(const DFTParameters &params);
 
@@ -148,13 +155,14 @@ public:
     DFTParameters m_dftparams;
 
     // Spectrogram
-//    std::vector<std::vector<WAVTYPE> > m_stft;
-    WAVTYPE* m_stftpa;
+    STFTStorage m_stft; // [dB]
     std::vector<FFTTYPE> m_stftts;
+    QByteArray m_wavhash; // Hash of the waveform for the STFT cache (computed when loaded)
     STFTComputeThread::STFTParameters m_stftparams;
+    QByteArray m_stftkey; // Key of m_stft in the STFT cache (if any, protected by m_mutex_changingstft)
     FFTTYPE m_stft_min;
     FFTTYPE m_stft_max;
-    QImage m_imgSTFT;
+    STFTImage m_imgSTFT;
     STFTComputeThread::ImageParameters m_imgSTFTParams; // This is the target parameters for the image
                                                         // During STFT update, it doesn't correspond to m_imgSTFT
 
@@ -22,6 +22,7 @@ file provided in the source code of DFasma. Another copy can be found at
 #include "gvspectrogramwdialogsettings.h"
 #include "ui_gvspectrogramwdialogsettings.h"
 #include "stftcomputethread.h"
+#include "windowcache.h"
 
 #include "wmainwindow.h"
 #include "ui_wmainwindow.h"
@@ -118,6 +119,31 @@ GVSpectrogram::GVSpectrogram(WMainWindow* parent)
     m_aAutoUpdate->setIcon(QIcon(":/icons/autoupdate.svg"));
 //    connect(m_aAutoUpdateDFT, SIGNAL(toggled(bool)), this, SLOT(settingsModified()));
 
+    m_aProgressive = new QAction(tr("Progressive STFT"), this);
+    m_aProgressive->setObjectName("m_aProgressive"); // For auto settings
+    m_aProgressive->setStatusTip(tr("Compute and show the visible part of the STFT first, then the rest of the file"));
+    m_aProgressive->setCheckable(true);
+    m_aProgressive->setChecked(true);
+    gMW->m_settings.add(m_aProgressive);
+
+    m_aZoomAdaptive = new QAction(tr("Adapt the STFT to the zoom"), this);
+    m_aZoomAdaptive->setObjectName("m_aZoomAdaptive"); // For auto settings
+    m_aZoomAdaptive->setStatusTip(tr("Compute about one frame per pixel when zoomed out, and only the visible part of the file when zoomed in"));
+    m_aZoomAdaptive->setCheckable(true);
+    m_aZoomAdaptive->setChecked(false);
+    gMW->m_settings.add(m_aZoomAdaptive);
+
+    m_aSinglePrecision = new QAction(tr("Compute the STFT in single precision"), this);
+    m_aSinglePrecision->setObjectName("m_aSinglePrecision"); // For auto settings
+    m_aSinglePrecision->setStatusTip(tr("Compute the DFTs of the spectrogram in single precision, which is faster and enough for the display (the spectrum is always computed in double precision)"));
+    m_aSinglePrecision->setCheckable(true);
+    m_aSinglePrecision->setChecked(false);
+    gMW->m_settings.add(m_aSinglePrecision);
+
+    m_zoomband_timer.setSingleShot(true);
+    m_zoomband_timer.setInterval(250);
+    connect(&m_zoomband_timer, SIGNAL(timeout()), this, SLOT(updateSTFTPlot()));
+
     m_stftcomputethread = new STFTComputeThread(this);
 
     // Cursor
@@ -235,6 +261,8 @@ GVSpectrogram::GVSpectrogram(WMainWindow* parent)
 
     connect(m_stftcomputethread, SIGNAL(stftComputingStateChanged(int)), this, SLOT(stftComputingStateChanged(int)));
     connect(m_stftcomputethread, SIGNAL(stftProgressing(int)), gMW->ui->pgbSpectrogramSTFTCompute, SLOT(setValue(int)));
+    connect(gMW->ui->pbSTFTComputingCancel, SIGNAL(clicked()), m_stftcomputethread, SLOT(cancelCurrentComputation()));
+    connect(m_stftcomputethread, SIGNAL(stftImageUpdated()), m_scene, SLOT(update()));
 
     // Fill the toolbar
     m_toolBar = new QToolBar(this);
@@ -256,6 +284,9 @@ GVSpectrogram::GVSpectrogram(WMainWindow* parent)
     m_contextmenu.addAction(m_aSavePicture);
     m_contextmenu.addSeparator();
     m_contextmenu.addAction(m_aAutoUpdate);
+    m_contextmenu.addAction(m_aProgressive);
+    m_contextmenu.addAction(m_aZoomAdaptive);
+    m_contextmenu.addAction(m_aSinglePrecision);
     m_contextmenu.addSeparator();
     m_contextmenu.addAction(m_aShowProperties);
     connect(m_aShowProperties, SIGNAL(triggered()), m_dlgSettings, SLOT(show()));
@@ -272,6 +303,8 @@ GVSpectrogram::GVSpectrogram(WMainWindow* parent)
     connect(gMW->m_qxtSpectrogramSpanSlider, SIGNAL(upperValueChanged(int)), this, SLOT(updateSTFTPlot()));
 
     connect(m_aAutoUpdate, SIGNAL(toggled(bool)), this, SLOT(autoUpdate(bool)));
+    connect(m_aZoomAdaptive, SIGNAL(toggled(bool)), this, SLOT(updateSTFTSettings()));
+    connect(m_aSinglePrecision, SIGNAL(toggled(bool)), this, SLOT(updateSTFTPlot()));
 
     updateSTFTSettings(); // Prepare a window from loaded settings
 }
@@ -345,41 +378,17 @@ void GVSpectrogram::updateSTFTSettings(){
     if(winlen%2==0 && m_dlgSettings->ui->cbSpectrogramWindowSizeForcedOdd->isChecked())
         winlen++;
 
-    // Create the window
+    // Create the window, normalized to sum=1 (immediate if it has been used recently)
     int wintype = m_dlgSettings->ui->cbSpectrogramWindowType->currentIndex();
-    if(wintype==0)
-        m_win = qae::rectangular(winlen);
-    else if(wintype==1)
-        m_win = qae::hamming(winlen);
-    else if(wintype==2)
-        m_win = qae::hann(winlen);
-    else if(wintype==3)
-        m_win = qae::blackman(winlen);
-    else if(wintype==4)
-        m_win = qae::blackmannutall(winlen);
-    else if(wintype==5)
-        m_win = qae::blackmanharris(winlen);
-    else if(wintype==6)
-        m_win = qae::nutall(winlen);
-    else if(wintype==7)
-        m_win = qae::flattop(winlen);
-    else if(wintype==8)
-        m_win = qae::normwindow(winlen, m_dlgSettings->ui->spSpectrogramWindowNormSigma->value());
-    else if(wintype==9)
-        m_win = qae::expwindow(winlen, m_dlgSettings->ui->spSpectrogramWindowExpDecay->value());
-    else if(wintype==10)
-        m_win = qae::gennormwindow(winlen, m_dlgSettings->ui->spSpectrogramWindowNormSigma->value(), m_dlgSettings->ui->spSpectrogramWindowNormPower->value());
-    else
-        throw QString("No window selected");
-
-//    assert(m_win.size()==winlen);
-
-    // Normalize the window energy to sum=1
-    double winsum = 0.0;
-    for(size_t n=0; n<m_win.size(); ++n)
-        winsum += m_win[n];
-    for(size_t n=0; n<m_win.size(); ++n)
-        m_win[n] /= winsum;
+    m_win = WindowCache::get(wintype, winlen, 0,
+                             (wintype==9)?m_dlgSettings->ui->spSpectrogramWindowExpDecay->value():m_dlgSettings->ui->spSpectrogramWindowNormSigma->value(),
+                             m_dlgSettings->ui->spSpectrogramWindowNormPower->value()).values();
+
+    m_stftcomputethread->m_cache.setEnabled(m_dlgSettings->ui->gbSpectrogramSTFTCache->isChecked());
+    m_stftcomputethread->m_cache.setLocation(m_dlgSettings->ui->leSpectrogramSTFTCacheLocation->text());
+    m_stftcomputethread->m_cache.setLimit(qint64(m_dlgSettings->ui->sbSpectrogramSTFTCacheLimit->value())*1024*1024);
+    // The bands kept in memory for the zoom share the limit of the STFT cache
+    m_stftcomputethread->m_cache.setBandsLimit(m_aZoomAdaptive->isChecked()?qint64(m_dlgSettings->ui->sbSpectrogramSTFTCacheLimit->value())*1024*1024:0);
 
     updateSTFTPlot();
 
@@ -449,15 +458,12 @@ void GVSpectrogram::stftComputingStateChanged(int state){
         gMW->ui->pbSTFTComputingCancel->setChecked(false);
         gMW->ui->pbSTFTComputingCancel->hide();
         gMW->ui->pgbSpectrogramSTFTCompute->hide();
-        // Use the visibility of lblSpectrogramInfoTxt to know if the canceled message has to be shown or not
-        // TODO ... very dirty
-        if(gMW->ui->lblSpectrogramInfoTxt->isVisible()){
-            gMW->ui->lblSpectrogramInfoTxt->setText(QString("STFT Canceled"));
-            gMW->ui->pbSpectrogramSTFTUpdate->show();
-            gMW->ui->wSpectrogramProgressWidgets->show();
-            m_giInfoTxtInCenter->setText("STFT Canceled.");
-            m_giInfoTxtInCenter->show();
-        }
+        // (the computations canceled by closing a sound are reported as finished)
+        gMW->ui->lblSpectrogramInfoTxt->setText(QString("STFT Canceled"));
+        gMW->ui->pbSpectrogramSTFTUpdate->show();
+        gMW->ui->wSpectrogramProgressWidgets->show();
+        m_giInfoTxtInCenter->setText("STFT Canceled.");
+        m_giInfoTxtInCenter->show();
     }
     else if(state==STFTComputeThread::SCSMemoryFull){
         m_giInfoTxtInCenter->setText("There is not enough free memory for computing this STFT.\nThe image itself is "+qae::humanReadableSize(m_dlgSettings->getLastImgSize())+"\nTry reducing the DFT size and/or increasing the time step size.");
@@ -487,32 +493,111 @@ void GVSpectrogram::updateSTFTPlot(bool force){
     if(csnd){
         m_giInfoTxtInCenter->setVisible(!csnd->m_actionShow->isChecked());
 
-        if(csnd->m_actionShow->isChecked()) {
-            if(force)
-                csnd->m_imgSTFTParams.clear();
-
-            int stepsize = std::floor(0.5+gFL->getFs()*m_dlgSettings->ui->sbSpectrogramStepSize->value());//[samples]
-
-            int dftlen = -1;
-            if(m_dlgSettings->ui->cbSpectrogramDFTSizeType->currentIndex()==0)
-                dftlen = m_dlgSettings->ui->sbSpectrogramDFTSize->value();
-            else if(m_dlgSettings->ui->cbSpectrogramDFTSizeType->currentIndex()==1)
-                dftlen = std::pow(2.0, std::ceil(log2(float(m_win.size())))+m_dlgSettings->ui->sbSpectrogramOversamplingFactor->value());//[samples]
-            int transform = gMW->m_gvSpectrogram->m_dlgSettings->ui->cbSpectrogramTransform->currentIndex();
-            int cepliftorder = -1;//[samples]
-            if(gMW->m_gvSpectrogram->m_dlgSettings->ui->gbSpectrogramCepstralLiftering->isChecked())
-                cepliftorder = gMW->m_gvSpectrogram->m_dlgSettings->ui->sbSpectrogramCepstralLifteringOrder->value();
-            bool cepliftpresdc = gMW->m_gvSpectrogram->m_dlgSettings->ui->cbSpectrogramCepstralLifteringPreserveDC->isChecked();
-
-            STFTComputeThread::STFTParameters reqSTFTParams(csnd, m_win, stepsize, dftlen, transform, cepliftorder, cepliftpresdc);
-            STFTComputeThread::ImageParameters reqImgSTFTParams(reqSTFTParams, &(csnd->m_imgSTFT), m_dlgSettings->ui->cbSpectrogramColorMaps->currentIndex(), m_dlgSettings->ui->cbSpectrogramColorMapReversed->isChecked(), gMW->m_qxtSpectrogramSpanSlider->lowerValue()/100.0, gMW->m_qxtSpectrogramSpanSlider->upperValue()/100.0, m_dlgSettings->ui->cbSpectrogramLoudnessWeighting->isChecked(), m_dlgSettings->ui->cbSpectrogramColorRangeMode->currentIndex(), csnd->getColor());
-
-            if(csnd->m_imgSTFTParams.isEmpty() || reqImgSTFTParams!=csnd->m_imgSTFTParams) {
-                gMW->ui->pbSpectrogramSTFTUpdate->hide();
-                m_stftcomputethread->compute(reqImgSTFTParams);
+        if(csnd->m_actionShow->isChecked())
+            requestSTFT(csnd, force, false);
+    }
+
+    // Prefetch the STFTs of the other sounds in the background,
+    // so that switching between sounds is immediate.
+    for(size_t fi=0; fi<gFL->ftsnds.size(); ++fi)
+        if(gFL->ftsnds[fi]!=csnd && gFL->ftsnds[fi]->m_actionShow->isChecked())
+            requestSTFT(gFL->ftsnds[fi], force, true);
+
+    // m_scene->update(); // Should not be called here, otherwise creates intermediate black background
+}
+
+void GVSpectrogram::requestSTFT(FTSound* snd, bool force, bool background){
+    if(force)
+        snd->m_imgSTFTParams.clear();
+
+    int stepsize = std::floor(0.5+gFL->getFs()*m_dlgSettings->ui->sbSpectrogramStepSize->value());//[samples]
+
+    int dftlen = -1;
+    if(m_dlgSettings->ui->cbSpectrogramDFTSizeType->currentIndex()==0)
+        dftlen = m_dlgSettings->ui->sbSpectrogramDFTSize->value();
+    else if(m_dlgSettings->ui->cbSpectrogramDFTSizeType->currentIndex()==1)
+        dftlen = std::pow(2.0, std::ceil(log2(float(m_win.size())))+m_dlgSettings->ui->sbSpectrogramOversamplingFactor->value());//[samples]
+    int transform = gMW->m_gvSpectrogram->m_dlgSettings->ui->cbSpectrogramTransform->currentIndex();
+    int cepliftorder = -1;//[samples]
+    if(gMW->m_gvSpectrogram->m_dlgSettings->ui->gbSpectrogramCepstralLiftering->isChecked())
+        cepliftorder = gMW->m_gvSpectrogram->m_dlgSettings->ui->sbSpectrogramCepstralLifteringOrder->value();
+    bool cepliftpresdc = gMW->m_gvSpectrogram->m_dlgSettings->ui->cbSpectrogramCepstralLifteringPreserveDC->isChecked();
+    int precision = m_dlgSettings->ui->cbSpectrogramSTFTPrecision->currentIndex();
+    bool ondisk = m_dlgSettings->ui->cbSpectrogramSTFTOnDisk->isChecked();
+    qint64 rangestart = 0;
+    qint64 rangeend = -1;
+    if(m_aZoomAdaptive->isChecked())
+        zoomBand(stepsize, rangestart, rangeend);
+
+    bool singleprecision = m_aSinglePrecision->isChecked();
+
+    STFTComputeThread::STFTParameters reqSTFTParams(snd, m_win, stepsize, dftlen, transform, cepliftorder, cepliftpresdc, precision, ondisk, rangestart, rangeend, singleprecision);
+    STFTComputeThread::ImageParameters reqImgSTFTParams(reqSTFTParams, &(snd->m_imgSTFT), m_dlgSettings->ui->cbSpectrogramColorMaps->currentIndex(), m_dlgSettings->ui->cbSpectrogramColorMapReversed->isChecked(), gMW->m_qxtSpectrogramSpanSlider->lowerValue()/100.0, gMW->m_qxtSpectrogramSpanSlider->upperValue()/100.0, m_dlgSettings->ui->cbSpectrogramLoudnessWeighting->isChecked(), m_dlgSettings->ui->cbSpectrogramColorRangeMode->currentIndex(), snd->getColor(), m_aProgressive->isChecked());
+
+    if(snd->m_imgSTFTParams.isEmpty() || reqImgSTFTParams!=snd->m_imgSTFTParams) {
+        // If only the colors change, update the color table right away
+        // (unless the thread is busy with the image)
+        if(!snd->m_imgSTFTParams.isEmpty()
+           && reqImgSTFTParams.hasSameIndices(snd->m_imgSTFTParams)
+           && !m_stftcomputethread->isComputing()
+           && m_stftcomputethread->m_mutex_computing.tryLock()){
+            STFTComputeThread::ColorMapping mapping;
+            mapping.prepare(reqImgSTFTParams);
+            mapping.setRange(snd->m_stft_min, snd->m_stft_max);
+            bool updated = snd->m_imgSTFT.setColors(mapping);
+            if(updated){
+                m_stftcomputethread->m_mutex_changingparams.lock();
+                snd->m_imgSTFTParams = reqImgSTFTParams;
+                m_stftcomputethread->m_mutex_changingparams.unlock();
+            }
+            m_stftcomputethread->m_mutex_computing.unlock();
+            if(updated){
+                m_scene->update();
+                return;
             }
         }
-        // m_scene->update(); // Should not be called here, otherwise creates intermediate black background
+
+        if(!background){
+            gMW->ui->pbSpectrogramSTFTUpdate->hide();
+            QRectF viewrect = mapToScene(viewport()->rect()).boundingRect();
+            m_stftcomputethread->setViewRange(viewrect.left(), viewrect.right());
+        }
+        m_stftcomputethread->compute(reqImgSTFTParams, background);
+    }
+}
+
+// When zoomed in, a band is made of this number of blocks, aligned on a grid of
+// block size, which is at most twice the view's width. The view starts in the
+// second block, so that the band doesn't change while scrolling within it.
+static const int s_zoomband_blocks = 3;
+// The bands are used only if the whole file has more frames than this number of
+// times the view's width [pixels], i.e. twice the biggest band.
+// Below, computing the whole file is hardly longer and doesn't change with the view.
+static const int s_zoomband_minframesperpixel = 2*2*s_zoomband_blocks;
+
+// The STFT resolution adapted to the view, by bands,
+// so that a band is displayed for a whole range of zooms and scrolls.
+void GVSpectrogram::zoomBand(int& stepsize, qint64& rangestart, qint64& rangeend){
+    QRectF viewrect = mapToScene(viewport()->rect()).boundingRect();
+    int width = viewport()->rect().width(); // [pixels]
+    if(width<=0 || viewrect.width()<=0.0 || stepsize<=0)
+        return;
+
+    double fs = gFL->getFs();
+    double viewhop = viewrect.width()*fs/width; // [samples/pixel]
+
+    if(viewhop>=2*stepsize){
+        // Zoomed out: the whole file, with at least one frame per pixel
+        // (the step size grows by powers of two)
+        stepsize *= 1<<int(std::floor(log2(viewhop/stepsize)));
+    }
+    else if(gFL->getMaxDuration()*fs/stepsize>s_zoomband_minframesperpixel*width){
+        // Zoomed in: only the band around the view, at the full resolution.
+        qint64 block = qint64(1)<<int(std::ceil(log2(viewrect.width()*fs))); // [samples] Power of two above the view's width
+        block = ((block+stepsize-1)/stepsize)*stepsize; // Multiple of the step size
+        qint64 bi = qint64(std::floor(std::max(0.0, viewrect.left()*fs)/block)); // The block where the view starts
+        rangestart = std::max(bi-1, qint64(0))*block;
+        rangeend = (bi-1+s_zoomband_blocks)*block;
     }
 }
 
@@ -537,13 +622,17 @@ void GVSpectrogram::savePicture(){
     QString fp = QFileDialog::getSaveFileName(gMW, "Save spectrogram as...", "", filters, &selectedFilter, QFileDialog::DontUseNativeDialog);
 
     if(!fp.isEmpty()){
+        m_stftcomputethread->m_mutex_changingstft.lock();
+        QImage img = csnd->m_imgSTFT.toImage();
+        m_stftcomputethread->m_mutex_changingstft.unlock();
+
         bool saved = false;
         if(selectedFilter!="*.*"){
             selectedFilter = selectedFilter.remove(0,2);
-            saved = csnd->m_imgSTFT.save(fp, selectedFilter.toLatin1().constData());
+            saved = img.save(fp, selectedFilter.toLatin1().constData());
         }
         else{
-            saved = csnd->m_imgSTFT.save(fp);
+            saved = img.save(fp);
         }
         if(!saved)
             QMessageBox::critical(NULL, "Saving failed!", "An error occured when saving the picture. Please verify you have written permission in the destination and the selectd format is supported.");
@@ -581,6 +670,10 @@ void GVSpectrogram::viewSet(QRectF viewrect, bool forwardsync) {
 
         fitInView(removeHiddenMargin(this, viewrect));
 
+        m_stftcomputethread->setViewRange(viewrect.left(), viewrect.right()); // For the progressive mode
+        if(m_aZoomAdaptive->isChecked())
+            m_zoomband_timer.start(); // Once the zoom is done
+
         updateTextsGeometry();
         m_giGrid->updateLines();
 
@@ -642,6 +735,11 @@ void GVSpectrogram::scrollContentsBy(int dx, int dy) {
 
     QGraphicsView::scrollContentsBy(dx, dy);
 
+    QRectF viewrect = mapToScene(viewport()->rect()).boundingRect();
+    m_stftcomputethread->setViewRange(viewrect.left(), viewrect.right());
+    if(m_aZoomAdaptive->isChecked())
+        m_zoomband_timer.start(); // Once the scrolling is done
+
     m_giGrid->updateLines();
 }
 
@@ -1388,12 +1486,13 @@ void GVSpectrogram::draw_spectrogram(QPainter* painter, const QRectF& rect, cons
     //    DCOUT << "Src: " << srcrect << std::endl;
     //    DCOUT << "Trg: " << trgrect << std::endl;
 
-    gMW->m_gvSpectrogram->m_stftcomputethread->m_mutex_changingstft.unlock();
+    // The released tiles might need the STFT values to be rendered again
+    snd->m_imgSTFT.draw(painter, trgrect, srcrect);
 
-    if(m_stftcomputethread->m_mutex_imageallocation.tryLock()) {
-        painter->drawImage(trgrect, snd->m_imgSTFT, srcrect);
-        m_stftcomputethread->m_mutex_imageallocation.unlock();
-    }
+    // Keep the tiles around the view, release the others if they take too much memory
+    snd->m_imgSTFT.releaseTilesOutside(int(2*srcrect.left()-srcrect.right()), int(2*srcrect.right()-srcrect.left()), 256*1024*1024);
+
+    gMW->m_gvSpectrogram->m_stftcomputethread->m_mutex_changingstft.unlock();
 }
 
 void GVSpectrogram::contextMenuEvent(QContextMenuEvent *event){
@@ -1406,14 +1505,12 @@ void GVSpectrogram::contextMenuEvent(QContextMenuEvent *event){
 }
 
 GVSpectrogram::~GVSpectrogram(){
-    m_stftcomputethread->m_mutex_computing.lock();
-    m_stftcomputethread->m_mutex_computing.unlock();
-    m_stftcomputethread->m_mutex_changingparams.lock();
-    m_stftcomputethread->m_mutex_changingparams.unlock();
-    m_stftcomputethread->wait();
-    delete m_stftcomputethread;
+    delete m_stftcomputethread; // Cancels and waits for the end of its thread
     delete m_dlgSettings;
 
+    delete m_aProgressive;
+    delete m_aZoomAdaptive;
+    delete m_aSinglePrecision;
     delete m_aAutoUpdate;
     delete m_aSpectrogramShowHarmonics;
     delete m_aSpectrogramShowGrid;
@@ -28,6 +28,7 @@ file provided in the source code of DFasma. Another copy can be found at
 #include <QMutex>
 #include <QThread>
 #include <QMenu>
+#include <QTimer>
 class QTime;
 
 #include "qaesigproc.h"
@@ -51,6 +52,9 @@ class GVSpectrogram : public QGraphicsView
 
     QGraphicsSimpleTextItem* m_giInfoTxtInCenter;
 
+    QTimer m_zoomband_timer;  // Updates the STFT once the view is settled
+    void zoomBand(int& stepsize, qint64& rangestart, qint64& rangeend);
+
 protected:
     void contextMenuEvent(QContextMenuEvent * event);
 
@@ -114,6 +118,9 @@ public:
     QAction* m_aSpectrogramShowGrid;
     QAction* m_aSpectrogramShowHarmonics;
     QAction* m_aAutoUpdate;
+    QAction* m_aProgressive;
+    QAction* m_aZoomAdaptive;
+    QAction* m_aSinglePrecision;
     QAction* m_aZoomOnSelection;
     QAction* m_aSelectionClear;
     QAction* m_aZoomIn;
@@ -139,6 +146,7 @@ public slots:
     void updateTextsGeometry();
     void updateSTFTSettings();
     void updateSTFTPlot(bool force=false);
+    void requestSTFT(FTSound* snd, bool force, bool background);
     void stftComputingStateChanged(int state);
     void showProgressWidgets();
     void autoUpdate(bool autoupdate);
@@ -22,8 +22,10 @@ file provided in the source code of DFasma. Another copy can be found at
 #include "ui_gvspectrogramwdialogsettings.h"
 
 #include <QSettings>
+#include <QFileDialog>
 
 #include "gvspectrogram.h"
+#include "stftcache.h"
 
 #include "../external/libqxt/qxtspanslider.h"
 
@@ -68,10 +70,18 @@ GVSpectrogramWDialogSettings::GVSpectrogramWDialogSettings(GVSpectrogram *parent
     connect(ui->sbSpectrogramDFTSize, SIGNAL(valueChanged(int)), this, SLOT(DFTSizeChanged(int)));
     connect(ui->sbSpectrogramOversamplingFactor, SIGNAL(valueChanged(int)), this, SLOT(DFTSizeChanged(int)));
     gMW->m_settings.add(ui->cbSpectrogramTransform);
+    gMW->m_settings.add(ui->cbSpectrogramSTFTPrecision);
+    gMW->m_settings.add(ui->cbSpectrogramSTFTOnDisk);
 
     gMW->m_settings.add(ui->gbSpectrogramCepstralLiftering);
     gMW->m_settings.add(ui->sbSpectrogramCepstralLifteringOrder);
     gMW->m_settings.add(ui->cbSpectrogramCepstralLifteringPreserveDC);
+
+    gMW->m_settings.add(ui->gbSpectrogramSTFTCache);
+    gMW->m_settings.add(ui->sbSpectrogramSTFTCacheLimit);
+    ui->leSpectrogramSTFTCacheLocation->setText(gMW->m_settings.value("leSpectrogramSTFTCacheLocation", STFTCache::defaultLocation()).toString());
+    connect(ui->pbSpectrogramSTFTCacheLocationBrowse, SIGNAL(clicked()), this, SLOT(STFTCacheLocationBrowse()));
+
     QStringList colormaps = QAEColorMap::getAvailableColorMaps();
     for(QStringList::Iterator it=colormaps.begin(); it!=colormaps.end(); ++it)
         ui->cbSpectrogramColorMaps->addItem(*it);
@@ -113,14 +123,20 @@ void GVSpectrogramWDialogSettings::checkImageSize(){
     int imgheight = dftlen/2+1;
     int imgwidth = int(1+double(maxsampleindex+1)/stepsize); // TODO Review this formula
 
-    m_lastimgsize = double(imgwidth)*imgheight*sizeof(QImage::Format_ARGB32);
+    m_lastimgsize = double(imgwidth)*imgheight; // 8bits indices
+
+    int valuesize = sizeof(FFTTYPE);
+    if(ui->cbSpectrogramSTFTPrecision->currentIndex()==STFTStorage::SPFloat32)
+        valuesize = sizeof(float);
+    else if(ui->cbSpectrogramSTFTPrecision->currentIndex()==STFTStorage::SPInt16)
+        valuesize = sizeof(qint16);
 
     QString text = "<html><head/><body>";
     text += QString("Image size: %1x%2 = %3").arg(imgwidth).arg(imgheight).arg(qae::humanReadableSize(m_lastimgsize));
+    text += QString("<br/>STFT size: %1").arg(qae::humanReadableSize(double(imgwidth)*imgheight*valuesize));
+    if(ui->cbSpectrogramSTFTOnDisk->isChecked())
+        text += " (on disk)";
 
-    if(imgwidth>32768 || imgheight>32768){
-        text += "<br/><font color=\"red\">Image dimensions need to be smaller than 32768.<br/>You can: increase step size, reduce window length, reduce oversampling factor,<br/>or try it! (visual artefacts expected)</font>";
-    }
     text += "</body></html>";
     ui->lblImgSizeWarning->setText(text);
 }
@@ -142,6 +158,12 @@ void GVSpectrogramWDialogSettings::colorRangeModeCurrentIndexChanged(int index){
     }
 }
 
+void GVSpectrogramWDialogSettings::STFTCacheLocationBrowse(){
+    QString location = QFileDialog::getExistingDirectory(this, "Location of the STFT cache", ui->leSpectrogramSTFTCacheLocation->text());
+    if(!location.isEmpty())
+        ui->leSpectrogramSTFTCacheLocation->setText(location);
+}
+
 void GVSpectrogramWDialogSettings::windowTypeCurrentIndexChanged(QString txt){
     ui->lblWindowNormSigma->hide();
     ui->spSpectrogramWindowNormSigma->hide();
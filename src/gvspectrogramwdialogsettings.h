@@ -58,6 +58,7 @@ private:
 private slots:
     void windowTypeCurrentIndexChanged(QString txt);
     void colorRangeModeCurrentIndexChanged(int index);
+    void STFTCacheLocationBrowse();
 
 public slots:
     void checkImageSize();
@@ -55,6 +55,7 @@ using namespace std;
 
 #include "qaesigproc.h"
 #include "qaehelpers.h"
+#include "../external/audioengine/audioengine.h"
 
 GVSpectrumAmplitude::GVSpectrumAmplitude(WMainWindow* parent)
     : QGraphicsView(parent)
@@ -136,9 +137,12 @@ GVSpectrumAmplitude::GVSpectrumAmplitude(WMainWindow* parent)
     m_aFollowPlayCursor->setChecked(false);
     gMW->m_settings.add(m_aFollowPlayCursor);
 
-    m_fft = new qae::FFTwrapper();
     qae::FFTwrapper::setTimeLimitForPlanPreparation(m_dlgSettings->ui->sbAmplitudeSpectrumFFTW3MaxTimeForPlanPreparation->value());
-    m_fftresizethread = new FFTResizeThread(m_fft, this);
+    FFTBackend::setTimeLimitForPlanPreparation(m_dlgSettings->ui->sbAmplitudeSpectrumFFTW3MaxTimeForPlanPreparation->value());
+    // Choose the fastest FFT implementation for each size range, with the plans of this time limit
+    // (before any FFT thread exists, see WMainWindow)
+    FFTBackend::benchmark();
+    m_dftcomputethread = new DFTComputeThread(this);
 
     // Cursor
     m_giCursorHoriz = new QGraphicsLineItem(0, -1000, 0, 1000);
@@ -241,8 +245,8 @@ GVSpectrumAmplitude::GVSpectrumAmplitude(WMainWindow* parent)
     gMW->ui->pgbFFTResize->hide();
     gMW->ui->lblSpectrumInfoTxt->setText("");
 
-    connect(m_fftresizethread, SIGNAL(fftResized(int,int)), this, SLOT(updateDFTs()));
-    connect(m_fftresizethread, SIGNAL(fftResizing(int,int)), this, SLOT(fftResizing(int,int)));
+    connect(m_dftcomputethread, SIGNAL(dftsReady()), this, SLOT(dftsReady()));
+    connect(m_dftcomputethread, SIGNAL(fftResizing(int,int)), this, SLOT(fftResizing(int,int)));
 
     // Fill the toolbar
     m_toolBar = new QToolBar(this);
@@ -423,53 +427,10 @@ void GVSpectrumAmplitude::setWindowRange(qreal tstart, qreal tend){
 
     FTSound::DFTParameters newDFTParams(nl, nr, winlen, wintype, normtype);
 
-    if(m_trgDFTParameters.isEmpty()
-       || m_trgDFTParameters.winlen!=newDFTParams.winlen
-       || m_trgDFTParameters.wintype!=newDFTParams.wintype
-       || m_trgDFTParameters.normtype!=newDFTParams.normtype
-       || wintype>7){
-
-        if(wintype==0)
-            m_win = qae::rectangular(newDFTParams.winlen);
-        else if(wintype==1)
-            m_win = qae::hamming(newDFTParams.winlen);
-        else if(wintype==2)
-            m_win = qae::hann(newDFTParams.winlen);
-        else if(wintype==3)
-            m_win = qae::blackman(newDFTParams.winlen);
-        else if(wintype==4)
-            m_win = qae::blackmannutall(newDFTParams.winlen);
-        else if(wintype==5)
-            m_win = qae::blackmanharris(newDFTParams.winlen);
-        else if(wintype==6)
-            m_win = qae::nutall(newDFTParams.winlen);
-        else if(wintype==7)
-            m_win = qae::flattop(newDFTParams.winlen);
-        else if(wintype==8)
-            m_win = qae::normwindow(newDFTParams.winlen, m_dlgSettings->ui->spAmplitudeSpectrumWindowNormSigma->value());
-        else if(wintype==9)
-            m_win = qae::expwindow(newDFTParams.winlen, m_dlgSettings->ui->spAmplitudeSpectrumWindowExpDecay->value());
-        else if(wintype==10)
-            m_win = qae::gennormwindow(newDFTParams.winlen, m_dlgSettings->ui->spAmplitudeSpectrumWindowNormSigma->value(), m_dlgSettings->ui->spAmplitudeSpectrumWindowNormPower->value());
-        else
-            throw QString("No window selected");
-
-        double winsum = 0.0;
-        if(normtype==0) {
-            // Normalize the window's sum to 1
-            for(int n=0; n<newDFTParams.winlen; n++)
-                winsum += m_win[n];
-        }
-        else if(normtype==1) {
-            // Normalize the window's energy to 1
-            for(int n=0; n<newDFTParams.winlen; n++)
-                winsum += m_win[n]*m_win[n];
-        }
-        for(int n=0; n<newDFTParams.winlen; n++)
-            m_win[n] /= winsum;
-
-        newDFTParams.win = m_win;
-    }
+    // Immediate if this window has been used recently
+    newDFTParams.win = WindowCache::get(wintype, winlen, normtype,
+                                       (wintype==9)?m_dlgSettings->ui->spAmplitudeSpectrumWindowExpDecay->value():m_dlgSettings->ui->spAmplitudeSpectrumWindowNormSigma->value(),
+                                       m_dlgSettings->ui->spAmplitudeSpectrumWindowNormPower->value());
 
     // Set the DFT length
     if(m_dlgSettings->ui->cbAmplitudeSpectrumDFTSizeType->currentIndex()==0)
@@ -536,151 +497,146 @@ void GVSpectrumAmplitude::updateDFTs(){
     if(m_trgDFTParameters.win.size()<2) // Avoid the DFT of one sample ...
         return;
 
-    m_fftresizethread->resize(m_trgDFTParameters.dftlen);
-
-    if(m_fftresizethread->m_mutex_resizing.tryLock()){
-        int dftlen = m_fft->size(); // Local copy of the actual dftlen
-
-        gMW->ui->pgbFFTResize->hide();
-        gMW->ui->lblSpectrumInfoTxt->setText(QString("DFT size=%1").arg(dftlen));
-
-        std::vector<FFTTYPE>& win = m_trgDFTParameters.win; // For speeding up access
-
-        bool didany = false;
-        for(unsigned int fi=0; fi<gFL->ftsnds.size(); fi++){
-            FTSound* snd = gFL->ftsnds[fi];
-            if(!snd->isVisible())
-                continue;
-
-            if(!snd->m_dftparams.isEmpty()
-               && snd->m_dftparams==m_trgDFTParameters
-               && snd->m_dftparams.wav==snd->wavtoplay
-               && snd->m_dftparams.ampscale==snd->m_giWavForWaveform->gain()
-               && snd->m_dftparams.delay==snd->m_giWavForWaveform->delay())
-                continue;
-
-            WAVTYPE gain = snd->m_giWavForWaveform->gain();
-
-            int n = 0;
-            int wn = 0;
-            for(; n<m_trgDFTParameters.winlen; n++){
-                wn = m_trgDFTParameters.nl+n - snd->m_giWavForWaveform->delay();
-
-                if(wn>=0 && wn<int(snd->wavtoplay->size())) {
-                    WAVTYPE value = gain*(*(snd->wavtoplay))[wn];
-
-                    if(value>1.0)       value = 1.0;
-                    else if(value<-1.0) value = -1.0;
-
-                    m_fft->in[n] = value*win[n];
-                }
-                else
-                    m_fft->in[n] = 0.0;
-            }
-            for(; n<dftlen; n++)
-                m_fft->in[n] = 0.0;
+    // Ask the DFTs which are outdated to the DFT thread
+    // (any previous request which is not started yet is replaced)
+    DFTComputeThread::Request req;
+    req.params = m_trgDFTParameters;
+    req.groupdelay = gMW->ui->actionShowGroupDelaySpectrum->isChecked();
+    req.window = m_aAmplitudeSpectrumShowWindow->isChecked();
+    req.fs = gFL->getFs();
+
+    // Only the amplitude is needed if the phase and the group delay are hidden.
+    // It can then be taken from the STFT, if any is computed with the same parameters.
+    bool amponly = !gMW->ui->actionShowPhaseSpectrum->isChecked() && !req.groupdelay;
+    // When following the play cursor, the windows between two STFT frames are interpolated
+    bool interpolate = m_aFollowPlayCursor->isChecked() && gMW->m_audioengine->state()==QAudio::ActiveState;
+
+    bool didany = false;
+    for(unsigned int fi=0; fi<gFL->ftsnds.size(); fi++){
+        FTSound* snd = gFL->ftsnds[fi];
+        if(!snd->isVisible())
+            continue;
 
-            m_fft->execute(); // Compute the DFT
+        if(!snd->m_dftparams.isEmpty()
+           && snd->m_dftparams==m_trgDFTParameters
+           && snd->m_dftparams.wav==snd->wavtoplay
+           && snd->m_dftparams.ampscale==snd->m_giWavForWaveform->gain()
+           && snd->m_dftparams.delay==snd->m_giWavForWaveform->delay()
+           && (!snd->m_dftparams.amponly || amponly)                // Phase shown since?
+           && (!req.groupdelay || !snd->m_dftgd.empty())            // Group delay shown since?
+           && (!snd->m_dftparams.interpolated || interpolate))      // Playback stopped since?
+            continue;
 
-            // Store first the complex values of the DFT
-            // (so that it can be used to compute the group delay)
-            std::vector<std::complex<WAVTYPE> > dft;
-            dft.resize(dftlen/2+1);
-            for(n=0; n<dftlen/2+1; n++)
-                dft[n] = m_fft->out[n];
+        if(amponly
+           && snd->wavtoplay==&(snd->wav) // The STFT is always computed on the original signal
+           && gMW->m_gvSpectrogram
+           && gMW->m_gvSpectrogram->m_stftcomputethread->copyFrame(snd, m_trgDFTParameters.win.values(), m_trgDFTParameters.dftlen, snd->m_giWavForWaveform->gain(), snd->m_giWavForWaveform->delay(), m_trgDFTParameters.nl, interpolate, snd->m_dftamp)){
+            m_dftcomputethread->cancelComputation(snd, false); // Any older DFT of this sound is obsolete
 
-            snd->m_dftamp.resize(dftlen/2+1);
-            for(n=0; n<dftlen/2+1; n++)
-                snd->m_dftamp[n] = 20*std::log10(std::abs(m_fft->out[n]));
+            int dftlen = m_trgDFTParameters.dftlen;
             snd->m_giWavForSpectrumAmplitude->updateMinMaxValues();
             snd->m_giWavForSpectrumAmplitude->setSamplingRate(1.0/double(gFL->getFs()/dftlen));
             snd->m_giWavForSpectrumAmplitude->clearCache();
 
-            snd->m_dftphase.resize(dftlen/2+1);
-            double delay = (2.0*M_PI*(win.size()-1)/2.0)/dftlen;
-            for(n=0; n<dftlen/2+1; n++){
-                if(qIsInf(snd->m_dftamp[n]))
-                    snd->m_dftphase[n] = std::numeric_limits<WAVTYPE>::infinity();
-                else
-                    snd->m_dftphase[n] = qae::wrap(std::arg(m_fft->out[n])+delay*n);
-            }
-            snd->m_giWavForSpectrumPhase->updateMinMaxValues();
-            snd->m_giWavForSpectrumPhase->setSamplingRate(1.0/double(gFL->getFs()/dftlen));
+            // The phase and group delay are computed again once shown (see amponly)
+            snd->m_dftphase.clear();
             snd->m_giWavForSpectrumPhase->clearCache();
+            snd->m_dftgd.clear();
+            snd->m_giWavForSpectrumGroupDelay->clearCache();
 
-            // If the group delay is requested, update its data
-            if(gMW->ui->actionShowGroupDelaySpectrum->isChecked()){
-                // y = nx[n]
-                for(int n=0; n<m_trgDFTParameters.winlen; n++)
-                    m_fft->in[n] *= n;
-
-                m_fft->execute(); // Compute the DFT of y
-
-                // (Xr*Yr+Xi*Yi) / |X|^2
-                snd->m_dftgd.resize(dftlen/2+1);
-                WAVTYPE fs = gFL->getFs();
-                WAVTYPE delay = ((m_trgDFTParameters.winlen-1)/2)/fs;
-                for(int n=0; n<dftlen/2+1; n++) {
-                    if(qIsInf(snd->m_dftamp[n]))
-                        snd->m_dftgd[n] = std::numeric_limits<WAVTYPE>::infinity();
-                    else {
-                        WAVTYPE xp2 = std::real(dft[n])*std::real(dft[n]) + std::imag(dft[n])*std::imag(dft[n]);
-                        snd->m_dftgd[n] = (std::real(dft[n])*std::real(m_fft->out[n]) + std::imag(dft[n])*std::imag(m_fft->out[n]))/xp2;
-
-                        snd->m_dftgd[n] /= fs; // measure it in [second]
-
-                        snd->m_dftgd[n] -= delay; // Remove the window's delay
-                    }
-                }
-                snd->m_giWavForSpectrumGroupDelay->updateMinMaxValues();
-                snd->m_giWavForSpectrumGroupDelay->setSamplingRate(1.0/double(gFL->getFs()/dftlen));
-                snd->m_giWavForSpectrumGroupDelay->clearCache();
-            }
-
-            // Convert the spectrum values to log values
             snd->m_dftparams = m_trgDFTParameters;
             snd->m_dftparams.wav = snd->wavtoplay;
             snd->m_dftparams.ampscale = snd->m_giWavForWaveform->gain();
             snd->m_dftparams.delay = snd->m_giWavForWaveform->delay();
+            snd->m_dftparams.amponly = true;
+            snd->m_dftparams.interpolated = interpolate; // Replaced by the exact DFT once the playback stops
+
+            gMW->ui->pgbFFTResize->hide();
+            gMW->ui->lblSpectrumInfoTxt->setText(QString("DFT size=%1").arg(dftlen));
 
             didany = true;
+            continue;
         }
 
-        // Compute the window's DFT
-        if (m_aAmplitudeSpectrumShowWindow->isChecked()) {
+        req.snds.push_back(snd);
+        req.sndparams.push_back(FTSound::DFTParameters());
+        req.sndparams.back() = m_trgDFTParameters;
+        req.sndparams.back().wav = snd->wavtoplay;
+        req.sndparams.back().ampscale = snd->m_giWavForWaveform->gain();
+        req.sndparams.back().delay = snd->m_giWavForWaveform->delay();
+    }
 
-            int n = 0;
-            for(; n<m_trgDFTParameters.winlen; n++)
-                m_fft->in[n] = m_trgDFTParameters.win[n];
-            for(; n<dftlen; n++)
-                m_fft->in[n] = 0.0;
+    m_dftcomputethread->compute(req);
 
-            m_fft->execute();
+    if(didany)
+        m_scene->update();
 
-            m_windft.resize(dftlen/2+1);
-            for(n=0; n<dftlen/2+1; n++)
-                m_windft[n] = qae::mag2db(m_fft->out[n]);
-            m_giWindow->updateMinMaxValues();
+//    COUTD << "~QGVAmplitudeSpectrum::updateDFTs" << endl;
+}
 
-            m_giWindow->setSamplingRate(1.0/double(gFL->getFs()/dftlen));
-            m_giWindow->updateGeometry();
-            m_giWindow->clearCache();
+void GVSpectrumAmplitude::dftsReady(){
+//    COUTD << "GVSpectrumAmplitude::dftsReady " << endl;
 
-            didany = true;
-        }
+    // Take the DFTs computed so far, by swapping them with the previous ones
+    // (the sounds' DFTs are thus never partially updated)
+    std::vector<DFTComputeThread::Result> results;
+    std::vector<FFTTYPE> windft;
+    int windftlen = m_dftcomputethread->takeResults(results, windft);
 
-        m_fftresizethread->m_mutex_resizing.unlock();
+    if(results.empty() && windftlen==0)
+        return;
 
-        if(didany){
-            m_scene->update();
-            if(gMW->m_gvSpectrumPhase)
-                gMW->m_gvSpectrumPhase->m_scene->update();
-            if(gMW->m_gvSpectrumGroupDelay)
-                gMW->m_gvSpectrumGroupDelay->m_scene->update();
+    for(size_t ri=0; ri<results.size(); ++ri){
+        DFTComputeThread::Result& res = results[ri];
+        FTSound* snd = res.snd;
+        int dftlen = res.params.dftlen;
+
+        snd->m_dftamp.swap(res.amp);
+        snd->m_giWavForSpectrumAmplitude->updateMinMaxValues();
+        snd->m_giWavForSpectrumAmplitude->setSamplingRate(1.0/double(gFL->getFs()/dftlen));
+        snd->m_giWavForSpectrumAmplitude->clearCache();
+
+        snd->m_dftphase.swap(res.phase);
+        snd->m_giWavForSpectrumPhase->updateMinMaxValues();
+        snd->m_giWavForSpectrumPhase->setSamplingRate(1.0/double(gFL->getFs()/dftlen));
+        snd->m_giWavForSpectrumPhase->clearCache();
+
+        if(!res.gd.empty()){
+            snd->m_dftgd.swap(res.gd);
+            snd->m_giWavForSpectrumGroupDelay->updateMinMaxValues();
+            snd->m_giWavForSpectrumGroupDelay->setSamplingRate(1.0/double(gFL->getFs()/dftlen));
+            snd->m_giWavForSpectrumGroupDelay->clearCache();
+        }
+        else if(!snd->m_dftgd.empty()){
+            snd->m_dftgd.clear(); // Outdated, computed again once shown
+            snd->m_giWavForSpectrumGroupDelay->clearCache();
         }
+
+        snd->m_dftparams = res.params;
+
+        gMW->ui->pgbFFTResize->hide();
+        gMW->ui->lblSpectrumInfoTxt->setText(QString("DFT size=%1").arg(dftlen));
     }
 
-//    COUTD << "~QGVAmplitudeSpectrum::updateDFTs" << endl;
+    if(windftlen>0){
+        m_windft.swap(windft);
+        m_giWindow->updateMinMaxValues();
+
+        m_giWindow->setSamplingRate(1.0/double(gFL->getFs()/windftlen));
+        m_giWindow->updateGeometry();
+        m_giWindow->clearCache();
+
+        gMW->ui->pgbFFTResize->hide();
+        gMW->ui->lblSpectrumInfoTxt->setText(QString("DFT size=%1").arg(windftlen));
+    }
+
+    m_scene->update();
+    if(gMW->m_gvSpectrumPhase)
+        gMW->m_gvSpectrumPhase->m_scene->update();
+    if(gMW->m_gvSpectrumGroupDelay)
+        gMW->m_gvSpectrumGroupDelay->m_scene->update();
+
+//    COUTD << "~GVSpectrumAmplitude::dftsReady" << endl;
 }
 
 void GVSpectrumAmplitude::viewSet(QRectF viewrect, bool sync) {
@@ -1415,13 +1371,7 @@ void GVSpectrumAmplitude::drawBackground(QPainter* painter, const QRectF& rect){
 }
 
 GVSpectrumAmplitude::~GVSpectrumAmplitude(){
-    m_fftresizethread->m_mutex_resizing.lock();
-    m_fftresizethread->m_mutex_resizing.unlock();
-    m_fftresizethread->m_mutex_changingsizes.lock();
-    m_fftresizethread->m_mutex_changingsizes.unlock();
-    m_fftresizethread->wait();
-    delete m_fftresizethread;
-    delete m_fft;
+    delete m_dftcomputethread;
     delete m_dlgSettings;
     delete m_toolBar;
 }
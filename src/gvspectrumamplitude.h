@@ -32,7 +32,7 @@ file provided in the source code of DFasma. Another copy can be found at
 #include "qaegigrid.h"
 
 #include "wmainwindow.h"
-#include "fftresizethread.h"
+#include "dftcomputethread.h"
 #include "ftsound.h"
 
 class GVAmplitudeSpectrumWDialogSettings;
@@ -45,7 +45,6 @@ class GVSpectrumAmplitude : public QGraphicsView
 
     QTime m_last_parameters_change;
 
-    std::vector<FFTTYPE> m_win; // Keep one here to limit allocations
 
 protected:
     void contextMenuEvent(QContextMenuEvent * event);
@@ -55,8 +54,7 @@ public:
 
     GVAmplitudeSpectrumWDialogSettings* m_dlgSettings;
 
-    qae::FFTwrapper* m_fft;
-    FFTResizeThread* m_fftresizethread;
+    DFTComputeThread* m_dftcomputethread;
 
     QGraphicsScene* m_scene;
 
@@ -140,6 +138,7 @@ public slots:
     void amplitudeMinChanged();
     void settingsModified();
     void updateDFTs();
+    void dftsReady();
     void fftResizing(int prevSize, int newSize);
 
     void setSamplingRate(double fs);
@@ -40,7 +40,8 @@ GVAmplitudeSpectrumWDialogSettings::GVAmplitudeSpectrumWDialogSettings(GVSpectru
     m_ampspec = parent;
 
     // Load the settings
-    #ifdef FFTW3RESIZINGMAXTIMESPENT
+    #ifdef FFT_FFTW3
+    // (the FFT plans are always measured, see FFTBackend)
     ui->lblAmplitudeSpectrumFFTW3MaxTimeForPlanPreparation->show();
     ui->sbAmplitudeSpectrumFFTW3MaxTimeForPlanPreparation->show();
     gMW->m_settings.add(ui->sbAmplitudeSpectrumFFTW3MaxTimeForPlanPreparation);
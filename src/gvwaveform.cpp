@@ -1153,7 +1153,11 @@ void GVWaveform::fixTimeLimitsToSamples(QRectF& selection, const QRectF& mouseSe
 
             int si = int((selection.center().x()*gFL->getFs()-1 - (cursnd->m_stftparams.win.size()-1)/2.0) / cursnd->m_stftparams.stepsize + 0.5);
             gMW->m_gvSpectrogram->m_stftcomputethread->m_mutex_changingstft.lock();
-            si = std::min(std::max(0, si), int(cursnd->m_stftts.size())-1);
+            if(!cursnd->m_stftts.empty()){
+                // The frames might cover only a part of the file (e.g. when the STFT adapts to the zoom)
+                int sifirst = int((cursnd->m_stftts.front()*gFL->getFs() - (cursnd->m_stftparams.win.size()-1)/2.0) / cursnd->m_stftparams.stepsize + 0.5);
+                si = std::min(std::max(sifirst, si), sifirst+int(cursnd->m_stftts.size())-1);
+            }
             gMW->m_gvSpectrogram->m_stftcomputethread->m_mutex_changingstft.unlock();
             selection.setLeft((si*cursnd->m_stftparams.stepsize)/gFL->getFs());
             selection.setRight((si*cursnd->m_stftparams.stepsize + cursnd->m_stftparams.win.size()-1)/gFL->getFs());
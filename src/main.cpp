@@ -50,6 +50,7 @@ extern "C" {
 #include <iostream>
 
 #include "qaehelpers.h"
+#include "fftplancache.h"
 
 #ifdef DEBUG_LOGFILE
 static QString g_debug_stream;
@@ -136,6 +137,10 @@ int main(int argc, char *argv[])
         Easdif::EasdifInit();
     #endif
 
+    // The FFT plans prepared in the previous sessions
+    // (the FFT implementations are then timed with the settings, see GVSpectrumAmplitude)
+    FFTPlanCache::loadWisdom();
+
     // Create the main window and run it
     WMainWindow* w = new WMainWindow(filestoload, gtvfilestoload, gtvb32filestoload, gtvb64filestoload);
     QObject::connect(&app, SIGNAL(focusWindowChanged(QWindow*)), w, SLOT(focusWindowChanged(QWindow*)));
@@ -147,6 +152,9 @@ int main(int argc, char *argv[])
 
     delete w;
 
+    FFTPlanCache::clear();
+    FFTPlanCache::saveWisdom();
+
     // Unload some external libraries
     #ifdef SUPPORT_SDIF
         Easdif::EasdifEnd();
@@ -0,0 +1,227 @@
+/*
+Copyright (C) 2015  Gilles Degottex <gilles.degottex@gmail.com>
+
+This file is part of DFasma.
+
+DFasma is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DFasma is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available in the LICENSE.txt
+file provided in the source code of DFasma. Another copy can be found at
+<http://www.gnu.org/licenses/>.
+*/
+
+#include "stftcache.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QStandardPaths>
+
+#include "stftstorage.h"
+
+#define STFTCACHE_MAGIC 0xDFA55F7F
+#define STFTCACHE_VERSION 1
+
+STFTCache::STFTCache()
+    : m_enabled(false)
+    , m_limit(0)
+    , m_bandslimit(0)
+{
+}
+
+QString STFTCache::defaultLocation() {
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)+"/stft";
+}
+
+void STFTCache::setEnabled(bool enabled) {
+    m_mutex.lock();
+    m_enabled = enabled;
+    m_mutex.unlock();
+}
+
+void STFTCache::setLocation(const QString& location) {
+    m_mutex.lock();
+    m_location = location;
+    m_mutex.unlock();
+}
+
+void STFTCache::setLimit(qint64 limit) {
+    m_mutex.lock();
+    m_limit = limit;
+    m_mutex.unlock();
+}
+
+bool STFTCache::isEnabled() {
+    m_mutex.lock();
+    bool enabled = m_enabled && !m_location.isEmpty() && m_limit>0;
+    m_mutex.unlock();
+    return enabled;
+}
+
+QString STFTCache::filePath(const QByteArray& key) {
+    m_mutex.lock();
+    QString location = m_location;
+    m_mutex.unlock();
+
+    return location+"/"+QString(key)+".stft";
+}
+
+// Mark the file as recently used by rewriting its first bytes
+// (which updates its modification time, whatever the Qt version)
+void STFTCache::touch(const QString& filepath) {
+    QFile file(filepath);
+    if(!file.open(QIODevice::ReadWrite))
+        return;
+    QByteArray head = file.read(4);
+    file.seek(0);
+    file.write(head);
+}
+
+bool STFTCache::load(const QByteArray& key, STFTStorage* stft, FFTTYPE* stftmin, FFTTYPE* stftmax) {
+    QString filepath = filePath(key);
+
+    QFile file(filepath);
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic, version;
+    qint32 stftlen, dftsize, precision;
+    double min, max;
+    in >> magic >> version >> stftlen >> dftsize >> precision >> min >> max;
+    if(in.status()!=QDataStream::Ok
+       || magic!=STFTCACHE_MAGIC || version!=STFTCACHE_VERSION
+       || stftlen!=stft->size() || dftsize!=stft->frameSize() || precision!=stft->precision())
+        return false;
+
+    if(!stft->read(&file))
+        return false;
+
+    *stftmin = min;
+    *stftmax = max;
+
+    file.close();
+    touch(filepath);
+
+    return true;
+}
+
+void STFTCache::store(const QByteArray& key, const STFTStorage* stft, FFTTYPE stftmin, FFTTYPE stftmax) {
+    m_mutex.lock();
+    QString location = m_location;
+    qint64 limit = m_limit;
+    m_mutex.unlock();
+
+    if(stft->allocatedSize()>limit)
+        return; // Would be evicted right away
+
+    if(!QDir().mkpath(location))
+        return;
+
+    // Written in a temporary file first, so that an interrupted writing
+    // never leaves a partial file in the cache
+    QSaveFile file(filePath(key));
+    if(!file.open(QIODevice::WriteOnly))
+        return;
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << quint32(STFTCACHE_MAGIC) << quint32(STFTCACHE_VERSION);
+    out << qint32(stft->size()) << qint32(stft->frameSize()) << qint32(stft->precision());
+    out << double(stftmin) << double(stftmax);
+
+    if(out.status()!=QDataStream::Ok || !stft->write(&file)){
+        file.cancelWriting();
+        return;
+    }
+    if(!file.commit())
+        return;
+
+    evict(location, limit);
+}
+
+void STFTCache::evict(const QString& location, qint64 limit) {
+    // Most recently used first
+    QFileInfoList files = QDir(location).entryInfoList(QStringList("*.stft"), QDir::Files, QDir::Time);
+
+    qint64 size = 0;
+    for(int fi=0; fi<files.size(); ++fi){
+        size += files[fi].size();
+        if(size>limit)
+            QFile::remove(files[fi].absoluteFilePath());
+    }
+}
+
+void STFTCache::setBandsLimit(qint64 limit) {
+    m_mutex.lock();
+    m_bandslimit = limit;
+    evictBands(m_bandslimit);
+    m_mutex.unlock();
+}
+
+bool STFTCache::keepsBands() {
+    m_mutex.lock();
+    bool keeps = m_bandslimit>0;
+    m_mutex.unlock();
+    return keeps;
+}
+
+void STFTCache::keepBand(const QByteArray& key, STFTStorage* stft, FFTTYPE stftmin, FFTTYPE stftmax) {
+    m_mutex.lock();
+    if(stft->allocatedSize()<=m_bandslimit){
+        Band band;
+        band.key = key;
+        band.stft = new STFTStorage();
+        band.stft->swap(*stft);
+        band.stftmin = stftmin;
+        band.stftmax = stftmax;
+        m_bands.push_front(band);
+        evictBands(m_bandslimit);
+    }
+    m_mutex.unlock();
+}
+
+bool STFTCache::takeBand(const QByteArray& key, STFTStorage* stft, FFTTYPE* stftmin, FFTTYPE* stftmax) {
+    m_mutex.lock();
+    std::list<Band>::iterator it=m_bands.begin();
+    while(it!=m_bands.end() && it->key!=key)
+        ++it;
+    bool found = it!=m_bands.end();
+    if(found){
+        stft->swap(*(it->stft));
+        *stftmin = it->stftmin;
+        *stftmax = it->stftmax;
+        delete it->stft;
+        m_bands.erase(it);
+    }
+    m_mutex.unlock();
+    return found;
+}
+
+void STFTCache::evictBands(qint64 limit) {
+    qint64 size = 0;
+    for(std::list<Band>::iterator it=m_bands.begin(); it!=m_bands.end();){
+        size += it->stft->allocatedSize();
+        if(size>limit){
+            delete it->stft;
+            it = m_bands.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+STFTCache::~STFTCache() {
+    evictBands(0);
+}
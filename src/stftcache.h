@@ -0,0 +1,89 @@
+/*
+Copyright (C) 2015  Gilles Degottex <gilles.degottex@gmail.com>
+
+This file is part of DFasma.
+
+DFasma is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DFasma is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available in the LICENSE.txt
+file provided in the source code of DFasma. Another copy can be found at
+<http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STFTCACHE_H
+#define STFTCACHE_H
+
+#include <list>
+
+#include <QString>
+#include <QByteArray>
+#include <QMutex>
+
+#include "qaesigproc.h"
+
+class STFTStorage;
+
+// Keeps the STFTs in files, so that reopening a sound with the same
+// parameters doesn't compute the DFTs again.
+// The files are named after a hash of the waveform and the STFT parameters.
+// When the size of the directory exceeds the limit, the least recently
+// used files are removed.
+// The STFTs of the zoom bands recently displayed are also kept in memory,
+// so that zooming back and forth doesn't compute (or read) them again.
+class STFTCache
+{
+    QMutex m_mutex; // Protects the settings and the bands
+    bool m_enabled;
+    QString m_location;
+    qint64 m_limit; // [bytes]
+
+    class Band{
+    public:
+        QByteArray key;
+        STFTStorage* stft;
+        FFTTYPE stftmin;
+        FFTTYPE stftmax;
+    };
+    std::list<Band> m_bands; // Most recently used first
+    qint64 m_bandslimit; // [bytes]
+    void evictBands(qint64 limit); // Assumes m_mutex is locked
+
+    QString filePath(const QByteArray& key);
+    void touch(const QString& filepath);
+    void evict(const QString& location, qint64 limit);
+
+public:
+    STFTCache();
+
+    static QString defaultLocation();
+
+    void setEnabled(bool enabled);
+    void setLocation(const QString& location);
+    void setLimit(qint64 limit);
+    bool isEnabled();
+
+    // The storage has to be allocated with the expected sizes beforehand.
+    // Returns false if the STFT is not in the cache (the values are then undefined).
+    bool load(const QByteArray& key, STFTStorage* stft, FFTTYPE* stftmin, FFTTYPE* stftmax);
+    void store(const QByteArray& key, const STFTStorage* stft, FFTTYPE stftmin, FFTTYPE stftmax);
+
+    // The bands in memory (0 disables them)
+    void setBandsLimit(qint64 limit);
+    bool keepsBands();
+    // Takes the values of stft, which is left empty
+    void keepBand(const QByteArray& key, STFTStorage* stft, FFTTYPE stftmin, FFTTYPE stftmax);
+    // Gives back the values of a band kept previously (stft has to be empty)
+    bool takeBand(const QByteArray& key, STFTStorage* stft, FFTTYPE* stftmin, FFTTYPE* stftmax);
+
+    ~STFTCache();
+};
+
+#endif // STFTCACHE_H
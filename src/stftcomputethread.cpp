@@ -19,8 +19,17 @@ file provided in the source code of DFasma. Another copy can be found at
 */
 
 #include "stftcomputethread.h"
+#include "stftimage.h"
+#include "stftstorage.h"
+#include "fftplancache.h"
+#include "dbkernels.h"
+
+#include <algorithm>
 
 #include <QtGlobal>
+#include <QElapsedTimer>
+#include <QCryptographicHash>
+#include <QDataStream>
 
 #include "wmainwindow.h"
 #include "ui_wmainwindow.h"
@@ -33,7 +42,7 @@ file provided in the source code of DFasma. Another copy can be found at
 #include "qaemath.h"
 #include "qaehelpers.h"
 
-STFTComputeThread::STFTParameters::STFTParameters(FTSound* reqnd, const std::vector<FFTTYPE>& reqwin, int reqstepsize, int reqdftlen, int reqtimefreqtrans, int reqcepliftorder, bool reqcepliftpresdc){
+STFTComputeThread::STFTParameters::STFTParameters(FTSound* reqnd, const std::vector<FFTTYPE>& reqwin, int reqstepsize, int reqdftlen, int reqtimefreqtrans, int reqcepliftorder, bool reqcepliftpresdc, int reqprecision, bool reqondisk, qint64 reqrangestart, qint64 reqrangeend, bool reqsingleprecision){
     clear();
 
     snd = reqnd;
@@ -45,6 +54,11 @@ STFTComputeThread::STFTParameters::STFTParameters(FTSound* reqnd, const std::vec
     timefreqtrans = reqtimefreqtrans;
     cepliftorder = reqcepliftorder;
     cepliftpresdc = reqcepliftpresdc;
+    precision = reqprecision;
+    ondisk = reqondisk;
+    rangestart = reqrangestart;
+    rangeend = reqrangeend;
+    singleprecision = reqsingleprecision;
 }
 
 bool STFTComputeThread::STFTParameters::operator==(const STFTParameters& param) const {
@@ -64,6 +78,14 @@ bool STFTComputeThread::STFTParameters::operator==(const STFTParameters& param)
         return false;
     if(cepliftpresdc!=param.cepliftpresdc)
         return false;
+    if(precision!=param.precision)
+        return false;
+    if(ondisk!=param.ondisk)
+        return false;
+    if(rangestart!=param.rangestart || rangeend!=param.rangeend)
+        return false;
+    if(singleprecision!=param.singleprecision)
+        return false;
     if(win.size()!=param.win.size())
         return false;
     for(size_t n=0; n<win.size(); n++)
@@ -73,14 +95,171 @@ bool STFTComputeThread::STFTParameters::operator==(const STFTParameters& param)
     return true;
 }
 
+bool STFTComputeThread::STFTParameters::isReusableFrom(const STFTParameters& param) const {
+    if(param.isEmpty() || snd!=param.snd)
+        return false;
+    if(ampscale<=0.0 || param.ampscale<=0.0)
+        return false;
+    // A delay multiple of the step size is a shift of frames
+    // (except for the FChT, which depends on the time of the frames)
+    if((delay-param.delay)%stepsize!=0 || (timefreqtrans==1 && delay!=param.delay))
+        return false;
+    if(stepsize!=param.stepsize)
+        return false;
+    if(dftlen!=param.dftlen)
+        return false;
+    if(timefreqtrans!=param.timefreqtrans)
+        return false;
+    if(cepliftorder!=param.cepliftorder)
+        return false;
+    if(cepliftpresdc!=param.cepliftpresdc)
+        return false;
+    if(rangestart!=param.rangestart || rangeend!=param.rangeend)
+        return false;
+    if(precision!=param.precision)  // The reused frames keep the storage they were computed in
+        return false;
+    if(ondisk!=param.ondisk)
+        return false;
+    if(singleprecision!=param.singleprecision)
+        return false;
+    if(win.size()!=param.win.size())
+        return false;
+    for(size_t n=0; n<win.size(); n++)
+        if(win[n]!=param.win[n])
+            return false;
+
+    return true;
+}
+
+void STFTRangeSketch::reset(FFTTYPE dbmin, FFTTYPE dbmax, FFTTYPE step) {
+    m_dbmin = dbmin;
+    m_step = step;
+    m_bins.assign(std::max(1, int(std::ceil((dbmax-dbmin)/step))), 0);
+    m_count = 0;
+}
+
+void STFTRangeSketch::add(const FFTTYPE* values, int size) {
+    int nbbins = int(m_bins.size());
+    FFTTYPE scale = 1.0/m_step;
+    for(int n=0; n<size; ++n){
+        FFTTYPE value = values[n];
+        if(qIsInf(value) || qIsNaN(value))
+            continue;
+        // The values outside of the range are counted in the first and last bins
+        int bin = int((value-m_dbmin)*scale);
+        bin = std::max(0, std::min(nbbins-1, bin));
+        m_bins[bin]++;
+        m_count++;
+    }
+}
+
+void STFTRangeSketch::merge(STFTRangeSketch& other) {
+    if(other.m_count==0)
+        return;
+    for(size_t b=0; b<m_bins.size() && b<other.m_bins.size(); ++b){
+        m_bins[b] += other.m_bins[b];
+        other.m_bins[b] = 0;
+    }
+    m_count += other.m_count;
+    other.m_count = 0;
+}
+
+FFTTYPE STFTRangeSketch::quantile(double q) const {
+    qint64 target = qint64(q*m_count);
+    qint64 cumul = 0;
+    size_t b = 0;
+    for(; b<m_bins.size()-1; ++b){
+        cumul += m_bins[b];
+        if(cumul>target)
+            break;
+    }
+    return m_dbmin+(b+0.5)*m_step;
+}
+
+STFTFramesWorker::STFTFramesWorker(STFTComputeThread* stftthread)
+    : QThread(stftthread)
+    , m_stftthread(stftthread)
+    , m_fftf(NULL)
+    , m_stftmin(std::numeric_limits<FFTTYPE>::infinity())
+    , m_stftmax(-std::numeric_limits<FFTTYPE>::infinity())
+{
+    m_fft = new FFTTransformer();
+    m_fftcep = new qae::FFTwrapper();
+}
+
+void STFTFramesWorker::run() {
+    m_stftmin = std::numeric_limits<FFTTYPE>::infinity();
+    m_stftmax = -std::numeric_limits<FFTTYPE>::infinity();
+
+    try{
+        m_stftthread->computeFrames(this);
+    }
+    catch(std::bad_alloc err){
+        // Stop the other workers, the compute thread reports it
+        m_stftthread->m_job_memoryfull.store(1);
+        m_stftthread->m_generation.ref();
+    }
+
+    m_stftthread->m_workers_done.release();
+}
+
+STFTFramesWorker::~STFTFramesWorker(){
+    // Their plans are destroyed under the cache's lock
+    FFTPlanCache::give(m_fft);
+    FFTPlanCache::give(m_fftf);
+    FFTPlanCache::give(m_fftcep);
+}
+
 STFTComputeThread::STFTComputeThread(QObject* parent)
     : QThread(parent)
+    , m_computing(false)
+    , m_quit(false)
+    , m_view_tstart(0.0)
+    , m_view_tend(0.0)
+    , m_running_generation(0)
+    , m_current_usercanceled(false)
+    , m_lifterbench_dftlen(-1)
+    , m_lifterbench_order(-1)
+    , m_lifterbench_direct(false)
 {
-    m_fft = new qae::FFTwrapper();
+    m_job.progressive = false;
+    m_job.lifterdirect = false;
+    m_job.stftts = NULL;
+    int nbworkers = std::max(1, QThread::idealThreadCount());
+    for(int wi=0; wi<nbworkers; ++wi)
+        m_workers.push_back(new STFTFramesWorker(this));
 //    setPriority(QThread::IdlePriority);
 }
 
-void STFTComputeThread::compute(ImageParameters reqImgSTFTParams) {
+// The key of an STFT in the cache
+QByteArray STFTComputeThread::cacheKey(const STFTParameters& params, int stftlen, int minsi, int samplesize) {
+    FTSound* snd = params.snd;
+
+    QByteArray params_data;
+    QDataStream params_stream(&params_data, QIODevice::WriteOnly);
+    params_stream << qint32(sizeof(WAVTYPE)) << qint32(sizeof(FFTTYPE));
+    params_stream << qint64(snd->wav.size()) << qint32(snd->fs) << qint32(samplesize);
+    params_stream << double(params.ampscale) << qint64(params.delay);
+    params_stream << qint32(params.win.size());
+    for(size_t n=0; n<params.win.size(); ++n)
+        params_stream << double(params.win[n]);
+    params_stream << qint32(params.stepsize) << qint32(params.dftlen) << qint32(params.timefreqtrans);
+    params_stream << qint32(params.cepliftorder) << params.cepliftpresdc << qint32(params.precision) << params.singleprecision;
+    params_stream << qint32(stftlen) << qint32(minsi);
+    if(params.timefreqtrans==1 && snd->m_f0){
+        // The FChT depends on the f0 curve
+        for(size_t n=0; n<snd->m_f0->ts.size(); ++n)
+            params_stream << double(snd->m_f0->ts[n]) << double(snd->m_f0->f0s[n]);
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(snd->m_wavhash); // Set when loaded, in the GUI thread
+    hash.addData(params_data);
+
+    return hash.result().toHex();
+}
+
+void STFTComputeThread::compute(ImageParameters reqImgSTFTParams, bool background) {
 //    DCOUT << "STFTComputeThread::compute" << std::endl;
 
     if(reqImgSTFTParams.stftparams.win.size()<2)
@@ -92,6 +271,8 @@ void STFTComputeThread::compute(ImageParameters reqImgSTFTParams) {
 
     m_mutex_changingparams.lock();
 
+    reqImgSTFTParams.background = background;
+
 //    DCOUT << "STFTComputeThread::compute winlen=" << reqImgSTFTParams.stftparams.win.size() << " stepsize=" << reqImgSTFTParams.stftparams.stepsize << " dftlen=" << reqImgSTFTParams.stftparams.dftlen << std::endl;
 
     // Check if this is necessary to re-compute the STFT.
@@ -100,23 +281,50 @@ void STFTComputeThread::compute(ImageParameters reqImgSTFTParams) {
             || (reqImgSTFTParams.stftparams.snd->m_stftparams!=reqImgSTFTParams.stftparams);
 
 //    DCOUT << "Compute STFT " << reqImgSTFTParams.stftparams.computestft << std::endl;
-    if(m_mutex_computing.tryLock()) {
-        // Currently not computing, so start it!
+    if(!m_computing) {
+        // Currently not computing, so wake the thread up!
 
         gMW->ui->pbSTFTComputingCancel->setChecked(false);
         gMW->ui->pbSTFTComputingCancel->show();
         gMW->ui->pbSpectrogramSTFTUpdate->hide();
 
         m_params_current = reqImgSTFTParams;
+        m_running_generation = m_generation.load();
+        m_current_usercanceled = false;
         m_computing = true;
-        start(); // Start computing
+        if(!isRunning())
+            start(); // Runs until the destruction, waiting for the next requests
+        m_request_cond.wakeOne();
     }
     else {
         // Currently computing something
-        // So cancel it and run the new params
-        if(reqImgSTFTParams!=m_params_current && reqImgSTFTParams!=m_params_todo) {
-            m_params_todo = reqImgSTFTParams;  // Ask to compute a new one, once the current computation is finished
-            gMW->ui->pbSTFTComputingCancel->setChecked(true);
+        FTSound* snd = reqImgSTFTParams.stftparams.snd;
+        FTSound* cursnd = m_params_current.stftparams.snd;
+
+        // A newer request for a sound supersedes the waiting one
+        unqueue(snd);
+
+        if(snd==cursnd){
+            // Cancel the current computation and run the new params right after
+            if(reqImgSTFTParams!=m_params_current) {
+                m_params_queue.push_front(reqImgSTFTParams);
+                m_generation.ref();
+            }
+        }
+        else if(background){
+            m_params_queue.push_back(reqImgSTFTParams);
+        }
+        else{
+            // The selected sound has the priority over the others,
+            // the interrupted one is done afterwards, in the background
+            m_params_queue.push_front(reqImgSTFTParams);
+            if(cursnd){
+                ImageParameters interrupted = m_params_current;
+                interrupted.background = true;
+                unqueue(cursnd);
+                m_params_queue.insert(m_params_queue.begin()+1, interrupted);
+                m_generation.ref();
+            }
         }
     }
 
@@ -125,32 +333,64 @@ void STFTComputeThread::compute(ImageParameters reqImgSTFTParams) {
 //    DCOUT << "STFTComputeThread::~compute" << std::endl;
 }
 
+void STFTComputeThread::unqueue(FTSound* snd) {
+    // Assumes m_mutex_changingparams is locked
+    for(std::deque<ImageParameters>::iterator it=m_params_queue.begin(); it!=m_params_queue.end();){
+        if(it->stftparams.snd==snd)
+            it = m_params_queue.erase(it);
+        else
+            ++it;
+    }
+}
+
 STFTComputeThread::~STFTComputeThread(){
-    delete m_fft;
+    // Cancel everything and end the thread
+    m_mutex_changingparams.lock();
+    m_params_queue.clear();
+    m_generation.ref();
+    m_quit = true;
+    m_request_cond.wakeAll();
+    m_mutex_changingparams.unlock();
+    wait();
+
+    for(size_t wi=0; wi<m_workers.size(); ++wi){
+        m_workers[wi]->wait();
+        delete m_workers[wi];
+    }
 }
 
 void STFTComputeThread::run() {
 //    DCOUT << "STFTComputeThread::run" << std::endl;
 
-    qae::tltrig_init(1024*1024);
-
-    // Prepare some usefull variables
-//    std::vector<WAVTYPE>::iterator pstft;
-    WAVTYPE* pstft;
-
-    bool canceled = false;
-    do{
+    // The thread runs until it is destroyed, so that compute() never waits for it to end
+    bool busy = false;              // m_mutex_computing is locked
+    bool reportcanceled = false;    // The selected sound's STFT has been canceled by the user or ran out of memory
+    for(;;){
         m_mutex_changingparams.lock();
+        // Sleep until compute() sets a request
+        while(!m_computing && !m_quit)
+            m_request_cond.wait(&m_mutex_changingparams);
+        if(m_quit){
+            m_mutex_changingparams.unlock();
+            break;
+        }
+        // The STFT might have been computed since the request was queued
+        m_params_current.stftparams.computestft = m_params_current.stftparams.snd->m_stftparams.isEmpty()
+                || (m_params_current.stftparams.snd->m_stftparams!=m_params_current.stftparams);
         ImageParameters params_running = m_params_current;
         m_mutex_changingparams.unlock();
+        if(!busy){
+            m_mutex_computing.lock();
+            busy = true;
+        }
+        bool memoryfull = false;
 
         try{
             int stepsize = params_running.stftparams.stepsize;
             int dftlen = params_running.stftparams.dftlen;
             int dftsize = int(params_running.stftparams.dftlen/2+1);
             int timefreqtrans = params_running.stftparams.timefreqtrans; // 0:DFT; 1:FChT
-            WAVTYPE* &stftpa = params_running.stftparams.snd->m_stftpa;
-            WAVTYPE* stftfrpa = NULL; // Pointer to a single frame
+            STFTStorage& stft = params_running.stftparams.snd->m_stft;
 
 //            params_running.stftparams.computestft = true; // TODO DEBUG REMOVE
 
@@ -160,9 +400,39 @@ void STFTComputeThread::run() {
             if(params_running.stftparams.computestft){
                 emit stftComputingStateChanged(SCSDFT);
 
-                m_fft->resize(params_running.stftparams.dftlen);
+                // The DFTs are computed by batches of frames, of about 2MB of input
+                m_job.batchsize = 1;
+                if(timefreqtrans==0)
+                    m_job.batchsize = std::max(1, std::min(32, (256*1024)/dftlen));
+                m_job.singleprecision = params_running.stftparams.singleprecision && timefreqtrans==0;
+
+                // Prepare the FFT plans one after the other
+                // (plan preparation is not thread-safe)
+                for(size_t wi=0; wi<m_workers.size(); ++wi){
+                    if(m_job.singleprecision){
+                        FFTPlanCache::resize(m_workers[wi]->m_fftf, params_running.stftparams.dftlen, m_job.batchsize);
+                    }
+                    else{
+                        FFTPlanCache::resize(m_workers[wi]->m_fft, params_running.stftparams.dftlen, m_job.batchsize);
+                        FFTPlanCache::give(m_workers[wi]->m_fftf); // Not needed anymore
+                        m_workers[wi]->m_fftf = NULL;
+                    }
+                    m_workers[wi]->m_windowedwavseg.resize(dftlen);
+                    m_workers[wi]->m_frame.resize(dftsize);
+                    m_workers[wi]->m_batchframes.resize(m_job.batchsize);
+                    m_workers[wi]->m_batchnonzero.resize(m_job.batchsize);
+                    if(params_running.stftparams.cepliftorder>0)
+                        FFTPlanCache::resize(m_workers[wi]->m_fftcep, params_running.stftparams.dftlen);
+                }
+
+                // If only the gain or the delay changed, the previous frames can be re-used
+                m_mutex_changingparams.lock();
+                STFTParameters prevparams = params_running.stftparams.snd->m_stftparams;
+                m_mutex_changingparams.unlock();
+                STFTStorage prevstft;
 
                 m_mutex_changingstft.lock();
+                params_running.imgstft->releaseSource(); // The STFT values are going to change
 
                 std::vector<FFTTYPE>& win = params_running.stftparams.win;
                 int winlen = int(win.size());
@@ -170,37 +440,64 @@ void STFTComputeThread::run() {
                 FFTTYPE stftmin = std::numeric_limits<FFTTYPE>::infinity();
                 FFTTYPE stftmax = -std::numeric_limits<FFTTYPE>::infinity();
                 qreal gain = params_running.stftparams.ampscale;
-                qint64 snddelay = params_running.stftparams.snd->m_giWavForWaveform->delay();
+                qint64 snddelay = params_running.stftparams.delay;
                 std::vector<FFTTYPE>& stftts = params_running.stftparams.snd->m_stftts;
                 std::vector<WAVTYPE>* wav = &params_running.stftparams.snd->wav;
-                std::vector<WAVTYPE> windowedwavseg; // The windowed signal segment to analyse
                 FTFZero* ff0 = params_running.stftparams.snd->m_f0;
                 std::vector<double> ahats; // For the FChT
 
-                int maxsampleindex = int(wav->size())-1 + int(params_running.stftparams.snd->m_giWavForWaveform->delay());
-                maxsampleindex = std::min(maxsampleindex, int(gFL->getFs()*gFL->getMaxLastSampleTime()));
+                // Sample indices in 64bits for very long files
+                qint64 maxsampleindex = qint64(wav->size())-1 + snddelay;
+                maxsampleindex = std::min(maxsampleindex, qint64(gFL->getFs()*gFL->getMaxLastSampleTime()));
+                if(params_running.stftparams.rangeend>=0)
+                    maxsampleindex = std::min(maxsampleindex, params_running.stftparams.rangeend);
 
-                int minsampleindex = int(params_running.stftparams.snd->m_giWavForWaveform->delay());
-                minsampleindex = std::max(minsampleindex, 0);
+                qint64 minsampleindex = snddelay;
+                minsampleindex = std::max(minsampleindex, qint64(0));
+                minsampleindex = std::max(minsampleindex, params_running.stftparams.rangestart);
                 int minsi = int(minsampleindex/stepsize);
 
                 // Allocate everything
                 int stftlen = 0;
-                for(int si=minsi; int(si*stepsize)<maxsampleindex; ++si)
+                for(int si=minsi; qint64(si)*stepsize<maxsampleindex; ++si)
                     stftlen++;
                 stftts.resize(stftlen);
                 int stfttsi = 0;
-                for(int si=minsi; int(si*stepsize)<maxsampleindex; ++si){
-                    stftts[stfttsi] = (si*stepsize+(winlen-1)/2.0)/fs;
+                for(int si=minsi; qint64(si)*stepsize<maxsampleindex; ++si){
+                    stftts[stfttsi] = (double(si)*stepsize+(winlen-1)/2.0)/fs;
                     stfttsi++;
                 }
-                if(stftpa)
-                    delete stftpa;
-                // Allocate it at once, to be sure the OS will reject it if it's too big
-                // (Linux tends to overcommit small memory allocations,
-                //  and ends up killing the app when it understands, too late,
-                //  that it doesn't have the memory)
-                stftpa = new WAVTYPE[stftlen*dftsize];
+                // The dynamic range of the file, covered by the 16bits fixed-point and the color range's histogram
+                // (from 3 times the SQNR below the full scale, like the color range slider)
+                int samplesize = params_running.stftparams.snd->format().sampleSize();
+                if(samplesize==-1)
+                    samplesize = int(8*sizeof(WAVTYPE));
+                FFTTYPE sqnr = 20*std::log10(std::pow(2.0, samplesize));
+                FFTTYPE fullscale = 0.0; // [dB] Max amplitude (the window's sum is 1 and the signal is clipped to [-1,1])
+                FFTTYPE dbmin = fullscale-3*sqnr;
+                FFTTYPE dbmax = fullscale;
+                if(params_running.stftparams.cepliftorder>0){
+                    if(params_running.stftparams.cepliftpresdc)
+                        dbmax += 6.0; // For the overshoots of the smoothing
+                    else
+                        dbmax += 3*sqnr; // Without the DC, the amplitudes are relative to their mean
+                }
+                QByteArray cachekey;
+                if((m_cache.isEnabled() || m_cache.keepsBands()) && stftlen>0)
+                    cachekey = cacheKey(params_running.stftparams, stftlen, minsi, samplesize);
+                bool reuse = params_running.stftparams.isReusableFrom(prevparams) && !stft.isEmpty();
+                if(reuse)
+                    prevstft.swap(stft); // Kept until its frames are copied
+                else if(!prevparams.isEmpty() && !params_running.stftparams.snd->m_stftkey.isEmpty() && m_cache.keepsBands())
+                    m_cache.keepBand(params_running.stftparams.snd->m_stftkey, &stft, params_running.stftparams.snd->m_stft_min, params_running.stftparams.snd->m_stft_max); // In case the view zooms back
+                params_running.stftparams.snd->m_stftkey.clear();
+                stft.clear();
+                // If this band has been displayed recently, take it back
+                bool fromcache = false;
+                if(!cachekey.isEmpty())
+                    fromcache = m_cache.takeBand(cachekey, &stft, &stftmin, &stftmax);
+                if(!fromcache)
+                    stft.allocate(stftlen, dftsize, params_running.stftparams.precision, dbmin, dbmax, params_running.stftparams.ondisk);
 
                 if(timefreqtrans==1){ // If ask for FChT...
                     // ...estimate the slope factor
@@ -219,185 +516,127 @@ void STFTComputeThread::run() {
                 }
                 m_mutex_changingstft.unlock();
 
-                WAVTYPE value;
-                int ni=0;
-                for(int si=minsi; int(si*stepsize)<maxsampleindex && !gMW->ui->pbSTFTComputingCancel->isChecked(); ++si){
-
-                    // Set the DFT's input
-                    int n = 0;
-                    int wn = 0;
-                    bool hasnonzerovalues = false;
-                    windowedwavseg.resize(dftlen);
-                    for(; n<int(win.size()); ++n){
-                        wn = si*stepsize+n - snddelay;
-                        value = 0.0;
-                        if(wn>=0 && wn<int(wav->size())) {
-                            value = gain*(*(wav))[wn];
-
-                            if(value>1.0)       value = 1.0;
-                            else if(value<-1.0) value = -1.0;
-
-                            value *= win[n];
-
-                            if(std::abs(value)>0.0)
-                                hasnonzerovalues = true;
+                // If this STFT has been computed previously, load it from the cache
+                if(!fromcache && !cachekey.isEmpty() && m_cache.isEnabled())
+                    fromcache = m_cache.load(cachekey, &stft, &stftmin, &stftmax);
+
+                if(!fromcache){
+                    m_job.snd = params_running.stftparams.snd;
+                    m_job.win = &win;
+                    m_job.wav = wav;
+                    m_job.stftts = &stftts;
+                    m_job.ahats = &ahats;
+                    m_job.ff0 = ff0;
+                    m_job.stft = &stft;
+                    m_job.gain = gain;
+                    m_job.snddelay = snddelay;
+                    m_job.stepsize = stepsize;
+                    m_job.dftlen = dftlen;
+                    m_job.dftsize = dftsize;
+                    m_job.timefreqtrans = timefreqtrans;
+                    m_job.cepliftorder = params_running.stftparams.cepliftorder;
+                    m_job.cepliftpresdc = params_running.stftparams.cepliftpresdc;
+                    if(m_job.cepliftorder>0)
+                        prepareLifter(m_workers[0]);
+                    m_job.minsi = minsi;
+                    m_job.stftlen = stftlen;
+                    // Small enough chunks to balance the load among the workers,
+                    // big enough to make the synchronisation negligible.
+                    m_job.chunksize = std::max(1, std::min(256, stftlen/int(16*m_workers.size())));
+                    // In multiples of the batches, which would be incomplete at the end of the chunks otherwise
+                    m_job.chunksize = ((m_job.chunksize+m_job.batchsize-1)/m_job.batchsize)*m_job.batchsize;
+                    m_job.todo.clear();
+                    int nbreused = 0;
+                    if(reuse)
+                        nbreused = reuseFrames(prevparams, prevstft, params_running.stftparams, minsi, stftmin, stftmax);
+                    prevstft.clear();
+                    m_job_framesdone.store(0);
+                    m_job_newcolumns.store(0);
+                    m_job_memoryfull.store(0);
+
+                    // In progressive mode, the image is drawn as the chunks are computed
+                    // (unless frames are re-used, the image is then drawn at once at the end)
+                    m_job.progressive = params_running.progressive && stftlen>0 && nbreused==0;
+                    m_job.rangesketch = false;
+                    if(m_job.progressive){
+                        allocateImage(params_running, stftlen, dftsize);
+                        m_job_mapping.prepare(params_running);
+                        // The actual range is unknown yet, so quantize the range of the request's colors
+                        // if absolute, or the dynamic range of the sound otherwise
+                        // (the image will be quantized again at the end)
+                        if(m_job_mapping.colorrangemode==1)
+                            m_job_mapping.setQuantization(100*params_running.lower, 100*params_running.upper);
+                        else
+                            m_job_mapping.setQuantization(dbmin, dbmax);
+                        m_job_mapping.setRange(-1.0, 0.0); // Unknown yet, if relative
+                        params_running.imgstft->setColorTable(m_job_mapping.colorTable());
+                        params_running.imgstft->fill(m_job_mapping.c0);
+                        m_job.img = params_running.imgstft;
+
+                        // The automatic color range is estimated from the distribution
+                        // of the amplitudes as they are computed (see updateJobColors)
+                        m_job.rangesketch = (m_job_mapping.colorrangemode==0);
+                        if(m_job.rangesketch){
+                            m_job_sketch.reset(dbmin, dbmax, 0.25);
+                            for(size_t wi=0; wi<m_workers.size(); ++wi)
+                                m_workers[wi]->m_sketch.reset(dbmin, dbmax, 0.25);
                         }
-                        m_fft->setInput(n, value);
-                        windowedwavseg[n] = value;
                     }
 
-                    if(hasnonzerovalues){
-                        // Zero-pad the DFT's input
-                        for(; n<dftlen; ++n){
-                            m_fft->setInput(n, 0.0);
-                            windowedwavseg[n] = 0.0;
-                        }
-
-                        if (timefreqtrans==0) {
-                            // Use DFT
-
-                            // TODO Use windowedwavseg instead of m_fft->setInput ?
-
-                            m_fft->execute(false); // Compute the DFT // Switch to FFTScarf #558
-
-                            // Retrieve DFT's output
-                            stftfrpa = stftpa+ni*dftsize;
-                            *stftfrpa = std::log(std::abs(m_fft->getDCOutput()));
-                            stftfrpa++;
-                            for(n=1; n<dftlen/2; ++n, stftfrpa++)
-                                *stftfrpa = std::log(std::abs(m_fft->getMidOutput(n)));
-                            *stftfrpa = std::log(std::abs(m_fft->getNyquistOutput()));
-
-        //                    for(n=0; n<=m_params_current.stftparams.dftlen/2; n++)
-        //                        m_params_current.stftparams.snd->m_stft[ni][n] = std::log(std::abs(m_fft->out[n]));
-        //                        m_params_current.stftparams.snd->m_stft[ni][n] = std::log(std::abs(m_fft->getMidOutput(n)));
-                        }
-                        else if(timefreqtrans==1) {
-                            if(ff0){
-                                // Use FChT
-                                double ahat = qae::interp_stepatzeros<double>(ff0->ts, ahats, stftts[ni]);
-                                if(std::isnan(ahat))
-                                    ahat = 0.0;
-                                if(std::isinf(ahat))
-                                    ahat = 0.0;
-//                                DCOUT << "wavsize=" << windowedwavseg.size() << " ahatsize=" << ahats.size() << " ahat=" << ahat << std::endl;
-
-                                // Clip ahat values
-                                if(ahat>2.0/winlen)
-                                    ahat = 2.0/winlen;
-                                if(ahat<-2.0/winlen)
-                                    ahat = -2.0/winlen;
-
-                                // Compute the FChT
-                                // TODO Needs look up table to speed up exp(jx) otherwise unusable
-                                WAVTYPE c = -2.0*M_PI/dftlen;
-                                WAVTYPE phi, cki;
-                                std::complex<WAVTYPE> a;
-                                for(int ki=0; ki<dftlen/2+1; ki++){
-                                    a = std::complex<WAVTYPE>(0.0,0.0);
-                                    cki = c*ki;
-                                    int xii = 0-(winlen-1)/2; // Not only for the window's delay !
-                                    for(int xi=0; xi<winlen; ++xi, ++xii){
-                                        phi = cki*((1.0+0.5*ahat*xii)*xii);
-//                                        a += windowedwavseg[xi]*std::sqrt(std::abs(1.0+ahat*xii))*qae::tlexpi(phi);
-                                        a += windowedwavseg[xi]*std::sqrt(std::abs(1.0+ahat*xii))*std::complex<WAVTYPE>(std::cos(phi), std::sin(phi));
-
-                                        // DFT
-                                        // phi = cki*xii;
-                                        // a += windowedwavseg[xi]*std::complex<WAVTYPE>(std::cos(phi), std::sin(phi));
-                                    }
-                                    stftpa[ni*dftsize+ki] = 0.5*std::log(a.real()*a.real()+a.imag()*a.imag());
-                                }
-                            }
-                        }
-
-                        if(params_running.stftparams.cepliftorder>0){
-                            // Prepare the window for cepstral smoothing
-                            std::vector<FFTTYPE> win = qae::hamming(params_running.stftparams.cepliftorder*2+1);
-                            std::vector<FFTTYPE> cc;
-                            // First, fix possible Inf amplitudes to avoid ending up with NaNs.
-                            if(qIsInf(stftpa[ni*dftsize+0]))
-                                stftpa[ni*dftsize+0] = stftpa[ni*dftsize+1]; // TOOD Use extrap ??
-                            for(int n=1; n<dftlen/2+1; ++n) {
-                                if(qIsInf(stftpa[ni*dftsize+n]))
-                                    stftpa[ni*dftsize+n] = stftpa[ni*dftsize+n-1]; // TOOD Use extrap ??
-                            }
-//                            // If we need to compute less coefficients than log(N),
-//                            // don't use the FFT, just compute these coefs.
-//                            // Could do: Optimize threshold according to time
-//                            // This is actually slower than computing all the coefs
-//                            // using the FFTW3 ...
-//                            if(params_running.stftparams.cepliftorder<std::log(dftlen)-1){
-//                                // Compute the Fourier coefs manually
-//                                std::vector<WAVTYPE> &frame = (stft[ni]);
-//                                std::vector<double> coses(dftlen/2+1);
-//                                for(int cci=1; cci<1+params_running.stftparams.cepliftorder; ++cci){
-//                                    double cc = frame[0];
-//                                    coses[0] = 1.0;
-//                                    for(int n=1; n<dftlen/2; ++n){
-//                                        coses[n] = cos(2.0*M_PI*cci*n/dftlen);
-//                                        cc += 2*frame[n]*coses[n];
-//                                    }
-//                                    coses[dftlen/2] = cos(M_PI*cci);
-//                                    cc += frame[dftlen/2]*coses[dftlen/2];
-//                                    cc /= dftlen;
-//                                    cc *= 2.0;
-
-//                                    for(int n=0; n<dftlen/2+1; ++n)
-//                                        frame[n] -= (1.0-win[cci-1])*cc*coses[n];
-//                                }
-//                                if(!params_running.stftparams.cepliftpresdc){
-//                                    double ccdc = frame[0];
-//                                    for(int n=1; n<dftlen/2; ++n)
-//                                        ccdc += 2*frame[n];
-//                                    ccdc += frame[dftlen/2];
-//                                    ccdc /= dftlen;
-//                                    for(int n=0; n<dftlen/2+1; ++n)
-//                                        frame[n] -= ccdc;
-//                                }
-//                            }
-//                            else{
-                                std::vector<FFTTYPE> values(stftpa+ni*dftsize, stftpa+ni*dftsize+dftsize);
-                                hspec2rcc(values, m_fft, cc);
-                                for(int cci=1; cci<1+params_running.stftparams.cepliftorder && cci<int(cc.size()); ++cci)
-                                    cc[cci] *= win[cci-1];
-                                if(!params_running.stftparams.cepliftpresdc)
-                                    cc[0] = 0.0;
-                                rcc2hspec(cc, m_fft, values);
-                                for(int n=0; n<dftlen/2+1; n++)
-                                    stftpa[ni*dftsize+n] = values[n];
-//                            }
-                        }
-
-                        // Convert to [dB] and compute min and max magnitudes[dB]
-                        stftfrpa = stftpa+ni*dftsize;
-                        for(n=0; n<dftlen/2+1; n++, stftfrpa++) {
-                            FFTTYPE value = qae::log2db*(*stftfrpa);
-
-                            if(qIsNaN(value))
-                                value = -std::numeric_limits<FFTTYPE>::infinity();
-
-                            *stftfrpa = value;
-
-                            // Do not consider Inf values as well as DC and Nyquist (Too easy to degenerate)
-                            if(n!=0 && n!=dftlen/2 && !qIsInf(value)) {
-                                stftmin = std::min(stftmin, value);
-                                stftmax = std::max(stftmax, value);
-                            }
+                    m_mutex_chunks.lock();
+                    m_job_runningmin = std::numeric_limits<FFTTYPE>::infinity();
+                    m_job_runningmax = -std::numeric_limits<FFTTYPE>::infinity();
+                    m_job_chunks.clear();
+                    int nbskipped = 0;
+                    for(int ni=0; ni<stftlen; ni+=m_job.chunksize){
+                        // Skip the chunks which are entirely re-used
+                        int niend = std::min(ni+m_job.chunksize, stftlen);
+                        if(m_job.todo.empty() || std::find(m_job.todo.begin()+ni, m_job.todo.begin()+niend, true)!=m_job.todo.begin()+niend)
+                            m_job_chunks.push_back(ni);
+                        else
+                            nbskipped += niend-ni;
+                    }
+                    m_job_framesdone.store(nbskipped);
+                    if(m_job.progressive)
+                        sortChunks(); // Visible frames first, then by distance to the view
+                    m_mutex_chunks.unlock();
+
+                    // Run the workers and wait for them, while reporting the progress
+                    QElapsedTimer lastimageupdate;
+                    lastimageupdate.start();
+                    for(size_t wi=0; wi<m_workers.size(); ++wi)
+                        m_workers[wi]->start();
+                    while(!m_workers_done.tryAcquire(int(m_workers.size()), 50)){
+                        reportProgress(int((100.0*m_job_framesdone.load())/std::max(1, stftlen)));
+
+                        // Rate-limit the updates of the view
+                        if(m_job.progressive
+                           && lastimageupdate.elapsed()>=100
+                           && m_job_newcolumns.fetchAndStoreOrdered(0)){
+                            updateJobColors(params_running.imgstft);
+                            emit stftImageUpdated();
+                            lastimageupdate.restart();
                         }
                     }
-                    else{
-                        stftfrpa = stftpa+ni*dftsize;
-                        for(n=0; n<dftsize; n++, stftfrpa++)
-                            *stftfrpa = -std::numeric_limits<FFTTYPE>::infinity();
+                    m_mutex_chunks.lock();
+                    m_job_chunks.clear(); // Drop the remaining ones, if canceled
+                    m_mutex_chunks.unlock();
+                    if(m_job.progressive && m_job_newcolumns.fetchAndStoreOrdered(0)){
+                        updateJobColors(params_running.imgstft);
+                        emit stftImageUpdated();
+                    }
+                    for(size_t wi=0; wi<m_workers.size(); ++wi){
+                        m_workers[wi]->wait();
+                        stftmin = std::min(stftmin, m_workers[wi]->m_stftmin);
+                        stftmax = std::max(stftmax, m_workers[wi]->m_stftmax);
+                    }
+                    if(m_job_memoryfull.fetchAndStoreOrdered(0)){
+                        m_mutex_changingstft.lock(); // As when thrown by the allocation above (see the catch below)
+                        throw std::bad_alloc();
                     }
-
-                    emit stftProgressing(int(100*double(ni*stepsize)/(maxsampleindex-minsampleindex)));
-
-                    ni++;
                 }
 
-                if(!gMW->ui->pbSTFTComputingCancel->isChecked()){
+                if(!isCanceled()){
                     // The STFT is done, update the min & max
                     m_mutex_changingparams.lock();
 
@@ -413,11 +652,15 @@ void STFTComputeThread::run() {
                         stftmax = stftmin + 1.0;
 
                     m_mutex_changingstft.lock();
+                    params_running.stftparams.snd->m_stftkey = cachekey;
                     params_running.stftparams.snd->m_stft_min = stftmin;
                     params_running.stftparams.snd->m_stft_max = stftmax;
                     m_mutex_changingstft.unlock();
 
                     m_mutex_changingparams.unlock();
+
+                    if(!cachekey.isEmpty() && !fromcache && m_cache.isEnabled())
+                        m_cache.store(cachekey, &stft, stftmin, stftmax);
                 }
             }
 
@@ -425,91 +668,46 @@ void STFTComputeThread::run() {
 //            DCOUT << "Spectrogram spent: " << telapsed/1000.0 << "s" << std::endl;
 
             // Update the STFT image
-            if(!gMW->ui->pbSTFTComputingCancel->isChecked()){
-                emit stftComputingStateChanged(SCSIMG);
+            if(!isCanceled()){
+                ColorMapping mapping;
+                mapping.prepare(params_running);
+                mapping.setRange(params_running.stftparams.snd->m_stft_min, params_running.stftparams.snd->m_stft_max);
 
-                m_mutex_imageallocation.lock();
-                if(int(params_running.stftparams.snd->m_stftts.size())==0){
-                    m_mutex_imageallocation.unlock();
-                }
-                else{
-                    int stftlen = int(params_running.stftparams.snd->m_stftts.size());
-                    int halfdftlen = params_running.stftparams.dftlen/2;
-                    *(params_running.imgstft) = QImage(stftlen, dftsize, QImage::Format_ARGB32);
-                    m_mutex_imageallocation.unlock();
-                    if(params_running.imgstft->isNull())
-                        throw std::bad_alloc();
-                    bool colormap_reversed = params_running.colormap_reversed;
+                // If only the colors change, the color table is enough
+                m_mutex_changingparams.lock();
+                ImageParameters previmgparams = params_running.stftparams.snd->m_imgSTFTParams;
+                m_mutex_changingparams.unlock();
+                bool requantize = params_running.stftparams.computestft
+                                  || previmgparams.isEmpty()
+                                  || !params_running.hasSameIndices(previmgparams)
+                                  || !params_running.imgstft->setColors(mapping);
+                if(requantize){
+                    emit stftComputingStateChanged(SCSIMG);
 
-                    QAEColorMap& cmap = QAEColorMap::getAt(params_running.colormap_index);
-                    cmap.setColor(params_running.color);
+                    params_running.imgstft->releaseSource(); // The tiles are going to change
 
-                    QRgb* pimgb = (QRgb*)(params_running.imgstft->bits());
+                    int stftlen = int(params_running.stftparams.snd->m_stftts.size());
+                    if(stftlen>0){
+                        allocateImage(params_running, stftlen, dftsize);
 
-                    FFTTYPE ymin = 0.0; // Init shouldn't be used
-                    FFTTYPE ymax = 1.0; // Init shouldn't be used
-                    if(params_running.colorrangemode==0){
-                        ymin = params_running.stftparams.snd->m_stft_min+(params_running.stftparams.snd->m_stft_max-params_running.stftparams.snd->m_stft_min)*gMW->m_qxtSpectrogramSpanSlider->lowerValue()/100.0;
-                        ymax = params_running.stftparams.snd->m_stft_min+(params_running.stftparams.snd->m_stft_max-params_running.stftparams.snd->m_stft_min)*gMW->m_qxtSpectrogramSpanSlider->upperValue()/100.0;
-                    }
-                    else if(params_running.colorrangemode==1){
-                        ymin = gMW->m_qxtSpectrogramSpanSlider->lowerValue(); // Min of color range [dB]
-                        ymax = gMW->m_qxtSpectrogramSpanSlider->upperValue(); // Max of color range [dB]
-                    }
+                        mapping.setQuantization(params_running.stftparams.snd->m_stft_min, params_running.stftparams.snd->m_stft_max);
+                        params_running.imgstft->setColorTable(mapping.colorTable());
 
-                    bool uselw = params_running.loudnessweighting;
-                    FFTTYPE divmaxmmin = 1.0/(ymax-ymin);
-        //            QRgb red = qRgb(int(255*1), int(255*0), int(255*0));
-                    QRgb c0 = colormap_reversed?cmap(1.0):cmap(0.0);
-                    QRgb c1 = colormap_reversed?cmap(0.0):cmap(1.0);
-                    FFTTYPE y;
-                    QRgb c;
-                    FFTTYPE v;
-
-                    // Prepare the loudness curve
-                    std::vector<WAVTYPE> elc;
-                    if(uselw) {
-                        elc = std::vector<WAVTYPE>(dftsize, 0.0);
-                        for(size_t u=0; u<elc.size(); ++u) {
-                            elc[u] = -qae::equalloudnesscurvesISO226(params_running.stftparams.snd->fs*double(u)/params_running.stftparams.dftlen, 0);
+                        int chunksize = 64;
+                        for(int si=0; si<stftlen && !isCanceled(); si+=chunksize){
+                            if(!params_running.imgstft->drawColumns(&stft, si, std::min(si+chunksize, stftlen), mapping))
+                                throw std::bad_alloc();
+                            reportProgress((100*si)/stftlen);
                         }
-                    }
 
-                    for(int si=0; si<stftlen && !gMW->ui->pbSTFTComputingCancel->isChecked(); si++, pimgb++){
-                        stftfrpa = stftpa+si*dftsize;
-                        for(int n=0; n<dftsize; n++, pstft++, stftfrpa++) {
-
-                            if(qIsInf(*stftfrpa)){
-                                c = c0;
-                            }
-                            else {
-                                v = *stftfrpa;
-                                if(uselw) v += elc[n]; // Modification according to loudness curve
-                                y = (v-ymin)*divmaxmmin;
-
-                                if(y<=0.0)
-                                    c = c0;
-                                else if(y>=1.0)
-                                    c = c1;
-                                else {
-                                    if(colormap_reversed)
-                                        y = 1.0-y;
-
-                                    c = cmap(y);
-                                }
-                            }
-
-    //                        *(pimgb + n*stftlen) = c;
-                            *(pimgb + (halfdftlen-n)*stftlen) = c; // This one has reversed y
-
-    //                         params_running.imgstft->setPixel(si, n, c); // Bit slower, though can take adv. of hardware optim ?
-                        }
-                        emit stftProgressing((100*si)/stftlen);
-                    }
+                        // The off-screen tiles can now be released and rendered again on demand
+                        if(!isCanceled())
+                            params_running.imgstft->setSource(&stft, mapping);
 
-                    // SampleSize is not always reliable
-        //            m_params_current.stftparams.snd->m_stft_min = std::max(FFTTYPE(-2.0*20*std::log10(std::pow(2.0,m_params_current.stftparams.snd->format().sampleSize()))), m_params_current.stftparams.snd->m_stft_min); Why doing this ??
-        //            COUTD << "Image Spent: " << starttime.elapsed() << std::endl;
+                        // SampleSize is not always reliable
+            //            m_params_current.stftparams.snd->m_stft_min = std::max(FFTTYPE(-2.0*20*std::log10(std::pow(2.0,m_params_current.stftparams.snd->format().sampleSize()))), m_params_current.stftparams.snd->m_stft_min); Why doing this ??
+            //            COUTD << "Image Spent: " << starttime.elapsed() << std::endl;
+                    }
                 }
 
                 m_mutex_changingparams.lock();
@@ -520,17 +718,17 @@ void STFTComputeThread::run() {
         catch(std::bad_alloc err){
             m_mutex_changingstft.unlock();
             m_mutex_changingstft.lock();
+            params_running.imgstft->releaseSource();
             params_running.stftparams.snd->m_stftts.clear();
-//            params_running.stftparams.snd->m_stft.clear();
-            delete params_running.stftparams.snd->m_stftpa;
-            params_running.stftparams.snd->m_stftpa = NULL;
+            params_running.stftparams.snd->m_stft.clear();
             m_mutex_changingstft.unlock();
 
             emit stftComputingStateChanged(SCSMemoryFull);
-            gMW->ui->pbSTFTComputingCancel->setChecked(true);
+            m_generation.ref();
+            memoryfull = true;
         }
 
-        canceled = gMW->ui->pbSTFTComputingCancel->isChecked();
+        bool canceled = isCanceled();
         if(canceled){
             m_mutex_changingparams.lock();
             if(params_running.stftparams.snd->m_stftparams != params_running.stftparams) {
@@ -539,68 +737,800 @@ void STFTComputeThread::run() {
 //                params_running.stftparams.snd->m_stft.clear();
                 params_running.stftparams.snd->m_stftparams.clear();
                 m_mutex_changingstft.unlock();
-                m_mutex_imageallocation.lock();
-                *(params_running.imgstft) = QImage(1, 1, QImage::Format_ARGB32);
-                params_running.imgstft->fill(Qt::white);
-                m_mutex_imageallocation.unlock();
+                params_running.imgstft->releaseSource();
+                params_running.imgstft->resize(1, 1);
+                params_running.imgstft->fill(qRgb(255, 255, 255));
             }
             m_mutex_changingparams.unlock();
-            gMW->ui->pbSTFTComputingCancel->setChecked(false);
         }
 
         // Check if it has to compute another
         m_mutex_changingparams.lock();
-        if(!m_params_todo.isEmpty()){
-            m_params_current = m_params_todo;
-            m_params_todo.clear();
+        // Superseded requests and closed sounds are canceled silently,
+        // and the requests in the background don't change what is reported
+        if(canceled && (m_current_usercanceled || memoryfull))
+            reportcanceled = true;
+        else if(!params_running.background)
+            reportcanceled = false;
+        if(!m_params_queue.empty()){
+            m_params_current = m_params_queue.front();
+            m_params_queue.pop_front();
+            m_running_generation = m_generation.load();
+            m_current_usercanceled = false;
         }
         else{
             m_params_current.clear();
             m_computing = false;
         }
+        bool idle = !m_computing;
+        m_current_cond.wakeAll();
         m_mutex_changingparams.unlock();
+
+        if(idle){
+            m_mutex_computing.unlock();
+            busy = false;
+
+            // The widgets are updated by the GUI thread only
+            if(reportcanceled)
+                emit stftComputingStateChanged(SCSCanceled);
+            else
+                emit stftComputingStateChanged(SCSFinished);
+            reportcanceled = false;
+        }
+    }
+
+//    DCOUT << "STFTComputeThread::~run" << std::endl;
+}
+
+void STFTComputeThread::computeFrames(STFTFramesWorker* worker) {
+    // Take the chunks of frames one after the other, until there is no more
+    while(!isCanceled()){
+        m_mutex_chunks.lock();
+        if(m_job_chunks.empty()){
+            m_mutex_chunks.unlock();
+            return;
+        }
+        int nibegin = m_job_chunks.front();
+        m_job_chunks.pop_front();
+        m_mutex_chunks.unlock();
+
+        int niend = std::min(nibegin+m_job.chunksize, m_job.stftlen);
+        int ni = nibegin;
+        if(m_job.timefreqtrans==0){
+            while(ni<niend && !isCanceled()){
+                // Gather the next frames to compute, up to the batch size
+                int count = 0;
+                int nb = ni;
+                for(; nb<niend && count<m_job.batchsize; ++nb)
+                    if(m_job.todo.empty() || m_job.todo[nb])
+                        worker->m_batchframes[count++] = nb;
+                if(count>0){
+                    if(m_job.singleprecision)
+                        computeFramesBatch<float>(worker, worker->m_fftf, count);
+                    else
+                        computeFramesBatch<FFTTYPE>(worker, worker->m_fft, count);
+                }
+                m_job_framesdone.fetchAndAddRelaxed(nb-ni);
+                ni = nb;
+            }
+        }
+        else{
+            for(; ni<niend && !isCanceled(); ++ni){
+                if(m_job.todo.empty() || m_job.todo[ni])
+                    computeFrame(worker, ni);
+                m_job_framesdone.fetchAndAddRelaxed(1);
+            }
+        }
+
+        if(m_job.progressive && ni==niend)
+            drawChunk(worker, nibegin, niend);
+    }
+}
+
+void STFTComputeThread::drawChunk(STFTFramesWorker* worker, int nibegin, int niend) {
+    // Update the range of the frames computed so far
+    m_mutex_chunks.lock();
+    m_job_runningmin = std::min(m_job_runningmin, worker->m_stftmin);
+    m_job_runningmax = std::max(m_job_runningmax, worker->m_stftmax);
+    if(m_job.rangesketch)
+        m_job_sketch.merge(worker->m_sketch);
+    m_mutex_chunks.unlock();
+
+    // If a tile can't be allocated, it will be rendered when drawn
+    // (only the quantization of m_job_mapping is used, which doesn't change)
+    m_job.img->drawColumns(m_job.stft, nibegin, niend, m_job_mapping);
+
+    m_job_newcolumns.store(1);
+}
+
+void STFTComputeThread::updateJobColors(STFTImage* img) {
+    // The color range follows the range of the frames computed so far
+    if(m_job_mapping.colorrangemode!=0)
+        return;
+
+    m_mutex_chunks.lock();
+    FFTTYPE runningmin = m_job_runningmin;
+    FFTTYPE runningmax = m_job_runningmax;
+    // The extreme values keep moving as more frames are computed,
+    // whereas the quantiles are stable from the first chunks.
+    // (the exact range is used once the STFT is finished)
+    if(m_job.rangesketch && m_job_sketch.count()>0){
+        FFTTYPE quantilemin = m_job_sketch.quantile(0.001);
+        FFTTYPE quantilemax = m_job_sketch.quantile(0.999);
+        if(quantilemin<quantilemax){
+            runningmin = std::max(runningmin, quantilemin);
+            runningmax = std::min(runningmax, quantilemax);
+        }
     }
-    while(m_computing);
+    m_mutex_chunks.unlock();
 
-    m_mutex_computing.unlock();
+    if(!qIsInf(runningmin) && !qIsInf(runningmax)){
+        ColorMapping colors = m_job_mapping;
+        colors.setRange(runningmin, runningmax);
+        img->setColorTable(colors.colorTable());
+    }
+}
 
-    if(canceled){
-        gMW->ui->lblSpectrogramInfoTxt->show();
-        emit stftComputingStateChanged(SCSCanceled);
+// Retrieve the log amplitude of the DFT's output
+static void getLogAmplitude(FFTTransformer* fft, int dftlen, FFTTYPE* frame) {
+    FFTTYPE* stftfrpa = frame;
+    *stftfrpa = std::log(std::abs(fft->getDCOutput()));
+    stftfrpa++;
+    for(int n=1; n<dftlen/2; ++n, stftfrpa++)
+        *stftfrpa = std::log(std::abs(fft->getMidOutput(n)));
+    *stftfrpa = std::log(std::abs(fft->getNyquistOutput()));
+}
+
+// The FChT, by direct evaluation of its sum (O(winlen*dftlen)).
+// Too slow for the spectrogram, but kept as a reference for fchtWarped.
+static void fchtExact(const std::vector<FFTTYPE>& windowedwavseg, int winlen, int dftlen, double ahat, FFTTYPE* frame) {
+    WAVTYPE c = -2.0*M_PI/dftlen;
+    WAVTYPE phi, cki;
+    std::complex<WAVTYPE> a;
+    for(int ki=0; ki<dftlen/2+1; ki++){
+        a = std::complex<WAVTYPE>(0.0,0.0);
+        cki = c*ki;
+        int xii = 0-(winlen-1)/2; // Not only for the window's delay !
+        for(int xi=0; xi<winlen; ++xi, ++xii){
+            phi = cki*((1.0+0.5*ahat*xii)*xii);
+            a += windowedwavseg[xi]*std::sqrt(std::abs(1.0+ahat*xii))*std::complex<WAVTYPE>(std::cos(phi), std::sin(phi));
+
+            // DFT
+            // phi = cki*xii;
+            // a += windowedwavseg[xi]*std::complex<WAVTYPE>(std::cos(phi), std::sin(phi));
+        }
+        frame[ki] = 0.5*std::log(a.real()*a.real()+a.imag()*a.imag());
+    }
+}
+
+// Cubic (Catmull-Rom) interpolation of seg at x, with zeros outside [0,winlen[
+static inline FFTTYPE interpCubic(const std::vector<FFTTYPE>& seg, int winlen, double x) {
+    int i = int(std::floor(x));
+    double t = x-i;
+    FFTTYPE p0 = (i-1>=0 && i-1<winlen)?seg[i-1]:0.0;
+    FFTTYPE p1 = (i>=0 && i<winlen)?seg[i]:0.0;
+    FFTTYPE p2 = (i+1>=0 && i+1<winlen)?seg[i+1]:0.0;
+    FFTTYPE p3 = (i+2>=0 && i+2<winlen)?seg[i+2]:0.0;
+    return p1 + 0.5*t*(p2-p0 + t*(2.0*p0-5.0*p1+4.0*p2-p3 + t*(3.0*(p1-p2)+p3-p0)));
+}
+
+// The FChT, by warping the time axis so that the chirp becomes stationary, and a single FFT.
+// With tau=(1+ahat/2*x)*x, the FChT's sum becomes a DFT along tau:
+//   X(k) = sum_tau s(x(tau)) / sqrt(1+ahat*x(tau)) * exp(-j*2pi*k*tau/dftlen)
+// The span of tau is the same as x's, thus winlen samples are enough.
+static void fchtWarped(FFTTransformer* fft, const std::vector<FFTTYPE>& windowedwavseg, int winlen, int dftlen, double ahat, FFTTYPE* frame) {
+    double xc = (winlen-1)/2.0;
+    double taumin = -(1.0-0.5*ahat*xc)*xc;
+    for(int m=0; m<winlen; ++m){
+        double tau = taumin+m;
+        double d = std::sqrt(std::max(0.0, 1.0+2.0*ahat*tau)); // =1+ahat*x
+        FFTTYPE value = 0.0;
+        if(d>0.0){
+            double x = 2.0*tau/(1.0+d); // Inverse of tau(x), stable for small ahat
+            value = interpCubic(windowedwavseg, winlen, x+xc)/std::sqrt(d);
+        }
+        fft->setInput(m, value);
+    }
+    // The rest of the input is already zero-padded
+
+    fft->execute();
+
+    getLogAmplitude(fft, dftlen, frame);
+}
+
+// Convert a frame of log amplitudes to [dB], after the cepstral liftering (if any),
+// and update the worker's min and max
+void STFTComputeThread::logToDB(STFTFramesWorker* worker, FFTTYPE* frame) {
+    int dftlen = m_job.dftlen;
+    int dftsize = m_job.dftsize;
+
+    if(m_job.cepliftorder>0){
+        // First, fix possible Inf amplitudes to avoid ending up with NaNs.
+        if(qIsInf(frame[0]))
+            frame[0] = frame[1]; // TOOD Use extrap ??
+        for(int n=1; n<dftsize; ++n) {
+            if(qIsInf(frame[n]))
+                frame[n] = frame[n-1]; // TOOD Use extrap ??
+        }
+
+        if(m_job.lifterdirect)
+            lifterDirect(worker, frame);
+        else
+            lifterFFT(worker, frame);
+    }
+
+    // Convert to [dB] and compute min and max magnitudes[dB]
+    // Do not consider DC and Nyquist (Too easy to degenerate)
+    FFTTYPE edgemin = 0.0; // Unused
+    FFTTYPE edgemax = 0.0;
+    DBKernels::scaleMinMax(frame, 1, qae::log2db, edgemin, edgemax);
+    DBKernels::scaleMinMax(frame+1, dftlen/2-1, qae::log2db, worker->m_stftmin, worker->m_stftmax);
+    DBKernels::scaleMinMax(frame+dftlen/2, dftsize-dftlen/2, qae::log2db, edgemin, edgemax);
+}
+
+// Store a finished frame [dB] in the STFT
+void STFTComputeThread::storeFrame(STFTFramesWorker* worker, int ni, const FFTTYPE* frame) {
+    if(m_job.rangesketch)
+        worker->m_sketch.add(frame+1, m_job.dftlen/2-1); // Without DC and Nyquist, as the min and max
+
+    m_job.stft->setFrame(ni, frame);
+}
+
+// The FChT of a frame
+// (the DFTs are computed by batches, see computeFramesBatch)
+void STFTComputeThread::computeFrame(STFTFramesWorker* worker, int ni) {
+    // Local copies, for speeding up access
+    FFTTransformer* fft = worker->m_fft;
+    std::vector<FFTTYPE>& windowedwavseg = worker->m_windowedwavseg;
+    std::vector<FFTTYPE>& win = *(m_job.win);
+    std::vector<WAVTYPE>* wav = m_job.wav;
+    std::vector<FFTTYPE>& stftts = *(m_job.stftts);
+    std::vector<double>& ahats = *(m_job.ahats);
+    FTFZero* ff0 = m_job.ff0;
+    FFTTYPE* frame = &(worker->m_frame[0]); // The frame is stored only once finished
+    qreal gain = m_job.gain;
+    qint64 snddelay = m_job.snddelay;
+    int stepsize = m_job.stepsize;
+    int dftlen = m_job.dftlen;
+    int dftsize = m_job.dftsize;
+    int winlen = int(win.size());
+    int si = m_job.minsi+ni;
+    WAVTYPE value;
+
+    // Set the DFT's input
+    int n = 0;
+    qint64 wn = 0;
+    bool hasnonzerovalues = false;
+    for(; n<winlen; ++n){
+        wn = qint64(si)*stepsize+n - snddelay;
+        value = 0.0;
+        if(wn>=0 && wn<qint64(wav->size())) {
+            value = gain*(*wav)[wn];
+
+            if(value>1.0)       value = 1.0;
+            else if(value<-1.0) value = -1.0;
+
+            value *= win[n];
+
+            if(std::abs(value)>0.0)
+                hasnonzerovalues = true;
+        }
+        fft->setInput(n, value);
+        windowedwavseg[n] = value;
+    }
+
+    if(hasnonzerovalues){
+        // Zero-pad the DFT's input
+        for(; n<dftlen; ++n){
+            fft->setInput(n, 0.0);
+            windowedwavseg[n] = 0.0;
+        }
+
+        if(ff0){
+            // Use FChT
+            double ahat = qae::interp_stepatzeros<double>(ff0->ts, ahats, stftts[ni]);
+            if(std::isnan(ahat))
+                ahat = 0.0;
+            if(std::isinf(ahat))
+                ahat = 0.0;
+
+            // Clip ahat values
+            if(ahat>2.0/winlen)
+                ahat = 2.0/winlen;
+            if(ahat<-2.0/winlen)
+                ahat = -2.0/winlen;
+
+            // Compute the FChT
+            #ifdef FCHT_EXACT
+                fchtExact(windowedwavseg, winlen, dftlen, ahat, frame);
+            #else
+                fchtWarped(fft, windowedwavseg, winlen, dftlen, ahat, frame);
+            #endif
+        }
+        else {
+            // Without f0 curve, there is no chirp rate to follow: Use DFT
+            // (the input is already set, as for the DFT)
+            fft->execute();
+            getLogAmplitude(fft, dftlen, frame);
+        }
+
+        logToDB(worker, frame);
     }
     else
-        emit stftComputingStateChanged(SCSFinished);
+        std::fill(frame, frame+dftsize, -std::numeric_limits<FFTTYPE>::infinity());
 
-//    DCOUT << "STFTComputeThread::~run" << std::endl;
+    storeFrame(worker, ni, frame);
+}
+
+// The DFTs of a batch of frames:
+// The segments are windowed directly into the contiguous input buffer of the batch,
+// which is then transformed at once, and the amplitudes [dB] are retrieved frame by frame.
+// T is the precision of the DFTs (the frames are always stored as FFTTYPE).
+template<typename T, class Transformer>
+void STFTComputeThread::computeFramesBatch(STFTFramesWorker* worker, Transformer* fft, int count) {
+    // Local copies, for speeding up access
+    FFTTYPE& stftmin = worker->m_stftmin;
+    FFTTYPE& stftmax = worker->m_stftmax;
+    const FFTTYPE* win = &((*(m_job.win))[0]);
+    const std::vector<WAVTYPE>& wav = *(m_job.wav);
+    qint64 wavsize = qint64(wav.size());
+    FFTTYPE* frame = &(worker->m_frame[0]);
+    WAVTYPE gain = m_job.gain;
+    qint64 snddelay = m_job.snddelay;
+    int stepsize = m_job.stepsize;
+    int dftlen = m_job.dftlen;
+    int dftsize = m_job.dftsize;
+    int winlen = int(m_job.win->size());
+
+    // Window the segments into the batch
+    for(int b=0; b<count; ++b){
+        T* in = fft->batchInput(b);
+        qint64 wnstart = qint64(m_job.minsi+worker->m_batchframes[b])*stepsize - snddelay;
+        bool hasnonzerovalues = false;
+        if(wnstart>=0 && wnstart+winlen<=wavsize){
+            // Entirely inside the signal, no need to check the bounds
+            const WAVTYPE* seg = &(wav[wnstart]);
+            for(int n=0; n<winlen; ++n){
+                WAVTYPE value = gain*seg[n];
+                value = std::max(WAVTYPE(-1.0), std::min(WAVTYPE(1.0), value));
+                in[n] = T(value*win[n]);
+            }
+            for(int n=0; n<winlen && !hasnonzerovalues; ++n)
+                hasnonzerovalues = (in[n]!=0.0);
+        }
+        else{
+            for(int n=0; n<winlen; ++n){
+                qint64 wn = wnstart+n;
+                WAVTYPE value = 0.0;
+                if(wn>=0 && wn<wavsize) {
+                    value = gain*wav[wn];
+                    value = std::max(WAVTYPE(-1.0), std::min(WAVTYPE(1.0), value));
+                    value *= win[n];
+                    if(value!=0.0)
+                        hasnonzerovalues = true;
+                }
+                in[n] = T(value);
+            }
+        }
+        // Zero-pad
+        std::fill(in+winlen, in+dftlen, T(0.0));
+        worker->m_batchnonzero[b] = hasnonzerovalues;
+    }
+
+    fft->executeBatch(count); // Compute the DFTs
+
+    const FFTTYPE minf = -std::numeric_limits<FFTTYPE>::infinity();
+    FFTTYPE edgemin = 0.0; // Min and max of DC and Nyquist, unused
+    FFTTYPE edgemax = 0.0;
+    for(int b=0; b<count; ++b){
+        if(!worker->m_batchnonzero[b]){
+            std::fill(frame, frame+dftsize, minf);
+        }
+        else{
+            const std::complex<T>* out = fft->batchOutput(b);
+
+            if(m_job.cepliftorder>0){
+                // Log amplitude, as getLogAmplitude()
+                for(int n=0; n<dftsize; ++n){
+                    FFTTYPE re = out[n].real();
+                    FFTTYPE im = out[n].imag();
+                    frame[n] = 0.5*std::log(re*re+im*im);
+                }
+
+                logToDB(worker, frame);
+            }
+            else{
+                // |X|^2 to [dB] directly, same as logToDB
+                DBKernels::powerToDB(out, 1, frame, edgemin, edgemax);
+                DBKernels::powerToDB(out+1, dftlen/2-1, frame+1, stftmin, stftmax);
+                DBKernels::powerToDB(out+dftlen/2, dftsize-dftlen/2, frame+dftlen/2, edgemin, edgemax);
+            }
+        }
+
+        storeFrame(worker, worker->m_batchframes[b], frame);
+    }
+}
+
+// Copy the frames of prevstft which are still valid for params into m_job.stft,
+// and mark the others to compute in m_job.todo.
+// Returns the number of frames re-used.
+int STFTComputeThread::reuseFrames(const STFTParameters& prevparams, const STFTStorage& prevstft, const STFTParameters& params, int minsi, FFTTYPE& stftmin, FFTTYPE& stftmax) {
+    const std::vector<WAVTYPE>& wav = params.snd->wav;
+    int stepsize = params.stepsize;
+    int dftsize = params.dftlen/2+1;
+    int winlen = int(params.win.size());
+    int stftlen = m_job.stft->size();
+    int prevminsi = int(std::max(std::max(prevparams.delay, qint64(0)), prevparams.rangestart)/stepsize);
+    int shift = int((params.delay-prevparams.delay)/stepsize); // [frames]
+
+    // A gain is an offset in dB, as long as the signal doesn't clip with either of the gains.
+    // If the DC of the cepstrum is removed, the offset is removed too.
+    FFTTYPE offset = 0.0;
+    std::vector<bool> clipped; // Per block of stepsize samples, aligned on the frames
+    int nblocks = (winlen+stepsize-1)/stepsize; // Blocks per frame
+    if(params.ampscale!=prevparams.ampscale){
+        if(params.cepliftorder<=0 || params.cepliftpresdc)
+            offset = qae::log2db*std::log(params.ampscale/prevparams.ampscale);
+
+        WAVTYPE threshold = 1.0/std::max(params.ampscale, prevparams.ampscale);
+        clipped.resize(stftlen+nblocks, false);
+        for(int b=0; b<int(clipped.size()); ++b){
+            qint64 wnstart = std::max(qint64(minsi+b)*stepsize-params.delay, qint64(0));
+            qint64 wnend = std::min(qint64(minsi+b+1)*stepsize-params.delay, qint64(wav.size()));
+            for(qint64 wn=wnstart; wn<wnend && !clipped[b]; ++wn)
+                if(std::abs(wav[wn])>threshold)
+                    clipped[b] = true;
+        }
+    }
+
+    m_job.todo.assign(stftlen, true);
+    std::vector<FFTTYPE> buffer(dftsize);
+    std::vector<FFTTYPE> values(dftsize);
+    int nbreused = 0;
+    for(int ni=0; ni<stftlen; ++ni){
+        int prevni = minsi+ni-shift-prevminsi;
+        if(prevni<0 || prevni>=prevstft.size())
+            continue;
+
+        bool clips = false;
+        for(int b=ni; b<ni+nblocks && b<int(clipped.size()) && !clips; ++b)
+            clips = clipped[b];
+        if(clips)
+            continue;
+
+        const FFTTYPE* prevframe = prevstft.frame(prevni, 0, dftsize, &buffer[0]);
+        for(int n=0; n<dftsize; ++n){
+            values[n] = prevframe[n]+offset; // -Inf stays -Inf
+
+            // Same as in computeFrame
+            if(n!=0 && n!=dftsize-1 && !qIsInf(values[n])) {
+                stftmin = std::min(stftmin, values[n]);
+                stftmax = std::max(stftmax, values[n]);
+            }
+        }
+        m_job.stft->setFrame(ni, &values[0]);
+
+        m_job.todo[ni] = false;
+        nbreused++;
+    }
+
+    return nbreused;
+}
+
+// Liftering through the real cepstrum, using FFTs
+void STFTComputeThread::lifterFFT(STFTFramesWorker* worker, FFTTYPE* frame) {
+    std::vector<FFTTYPE>& values = worker->m_cepvalues;
+    std::vector<FFTTYPE>& cc = worker->m_cc;
+    values.assign(frame, frame+m_job.dftsize);
+    hspec2rcc(values, worker->m_fftcep, cc);
+    for(int cci=1; cci<1+m_job.cepliftorder && cci<int(cc.size()); ++cci)
+        cc[cci] *= m_job.lifter[cci-1];
+    if(!m_job.cepliftpresdc)
+        cc[0] = 0.0;
+    rcc2hspec(cc, worker->m_fftcep, values);
+    std::copy(values.begin(), values.begin()+m_job.dftsize, frame);
+}
+
+// Liftering by computing only the cepstral coefs to modify, with direct cosine sums.
+// Faster than the FFTs for low orders.
+void STFTComputeThread::lifterDirect(STFTFramesWorker* worker, FFTTYPE* frame) {
+    int dftlen = m_job.dftlen;
+    int order = std::min(m_job.cepliftorder, dftlen/2);
+    const FFTTYPE* costable = &(m_job.costable[0]);
+    std::vector<FFTTYPE>& cc = worker->m_cc;
+    cc.resize(order+1);
+
+    // The coefs to modify, cc[q]=sum_n S[n]*cos(2*pi*q*n/dftlen)/dftlen (on the full spectrum)
+    for(int q=(m_job.cepliftpresdc?1:0); q<=order; ++q){
+        FFTTYPE sum = frame[0];
+        int idx = 0;
+        for(int n=1; n<dftlen/2; ++n){
+            idx += q;
+            if(idx>=dftlen) idx -= dftlen;
+            sum += 2*frame[n]*costable[idx];
+        }
+        sum += (q%2==0)?frame[dftlen/2]:-frame[dftlen/2];
+        cc[q] = sum/dftlen;
+    }
+
+    // Remove the attenuated parts of these coefs from the spectrum
+    if(!m_job.cepliftpresdc)
+        for(int n=0; n<dftlen/2+1; ++n)
+            frame[n] -= cc[0];
+    for(int q=1; q<=order; ++q){
+        FFTTYPE coef = 2*(1.0-m_job.lifter[q-1])*cc[q];
+        int idx = 0;
+        for(int n=0; n<dftlen/2+1; ++n){
+            frame[n] -= coef*costable[idx];
+            idx += q;
+            if(idx>=dftlen) idx -= dftlen;
+        }
+    }
+}
+
+// Prepare the liftering of the job, and choose the fastest implementation
+// by timing both of them on a test frame (for each new DFT length and order)
+void STFTComputeThread::prepareLifter(STFTFramesWorker* worker) {
+    int dftlen = m_job.dftlen;
+    int dftsize = m_job.dftsize;
+
+    std::vector<FFTTYPE> win = qae::hamming(m_job.cepliftorder*2+1);
+    m_job.lifter.assign(win.begin(), win.begin()+m_job.cepliftorder);
+
+    m_job.costable.resize(dftlen);
+    for(int n=0; n<dftlen; ++n)
+        m_job.costable[n] = std::cos((2.0*M_PI*n)/dftlen);
+
+    if(m_lifterbench_dftlen!=dftlen || m_lifterbench_order!=m_job.cepliftorder){
+        std::vector<FFTTYPE> test(dftsize);
+        for(int n=0; n<dftsize; ++n)
+            test[n] = std::log(1.0+std::abs(std::sin(0.1*n)));
+        std::vector<FFTTYPE> frame(dftsize);
+
+        // Interleaved, to share the disturbances between both
+        QElapsedTimer timer;
+        qint64 tdirect = 0;
+        qint64 tfft = 0;
+        for(int it=0; it<8; ++it){
+            frame = test;
+            timer.start();
+            lifterDirect(worker, &(frame[0]));
+            tdirect += timer.nsecsElapsed();
+
+            frame = test;
+            timer.start();
+            lifterFFT(worker, &(frame[0]));
+            tfft += timer.nsecsElapsed();
+        }
+        // DCOUT << "Liftering: direct=" << tdirect << "ns FFT=" << tfft << "ns" << std::endl;
+
+        m_lifterbench_dftlen = dftlen;
+        m_lifterbench_order = m_job.cepliftorder;
+        m_lifterbench_direct = tdirect<tfft;
+    }
+    m_job.lifterdirect = m_lifterbench_direct;
+}
+
+void STFTComputeThread::reportProgress(int percent) {
+    // Rate-limited, to avoid flooding the event loop with queued signals
+    if(m_progress_lastemit.isValid() && m_progress_lastemit.elapsed()<PROGRESSINTERVAL)
+        return;
+    m_progress_lastemit.start();
+    emit stftProgressing(percent);
+}
+
+void STFTComputeThread::setViewRange(double tstart, double tend) {
+    m_mutex_chunks.lock();
+    m_view_tstart = tstart;
+    m_view_tend = tend;
+    if(m_job.progressive && !m_job_chunks.empty())
+        sortChunks();
+    m_mutex_chunks.unlock();
+}
+
+class ChunkCloserToView {
+    const std::vector<FFTTYPE>& m_stftts;
+    int m_chunksize;
+    double m_tstart;
+    double m_tend;
+
+    double distance(int nibegin) const {
+        double tbegin = m_stftts[nibegin];
+        double tend = m_stftts[std::min(nibegin+m_chunksize, int(m_stftts.size()))-1];
+        if(tend<m_tstart)
+            return m_tstart-tend;
+        else if(tbegin>m_tend)
+            return tbegin-m_tend;
+        return 0.0; // Visible
+    }
+
+public:
+    ChunkCloserToView(const std::vector<FFTTYPE>& stftts, int chunksize, double tstart, double tend)
+        : m_stftts(stftts)
+        , m_chunksize(chunksize)
+        , m_tstart(tstart)
+        , m_tend(tend)
+    {}
+
+    bool operator()(int nia, int nib) const {
+        return distance(nia)<distance(nib);
+    }
+};
+
+bool STFTComputeThread::copyFrame(FTSound* snd, const std::vector<FFTTYPE>& win, int dftlen, FFTTYPE ampscale, qint64 delay, qint64 nl, bool interpolate, std::vector<FFTTYPE>& amp) {
+    if(!m_mutex_changingparams.tryLock())
+        return false;
+
+    // The frames of snd can change only when its STFT is computed,
+    // which cannot start while m_mutex_changingparams is locked.
+    const STFTParameters& params = snd->m_stftparams;
+    bool copied = !params.isEmpty()
+                  && !(m_computing && m_params_current.stftparams.snd==snd && params!=m_params_current.stftparams)
+                  && params.timefreqtrans==0
+                  && params.cepliftorder<=0
+                  && params.precision==STFTStorage::SPFull
+                  && !params.singleprecision
+                  && params.dftlen==dftlen
+                  && params.ampscale==ampscale
+                  && params.delay==delay
+                  && params.win==win
+                  && !snd->m_stft.isEmpty();
+
+    if(copied){
+        int stepsize = params.stepsize;
+        int dftsize = dftlen/2+1;
+        int stftlen = snd->m_stft.size();
+        int minsi = int(std::max(std::max(params.delay, qint64(0)), params.rangestart)/stepsize); // As in run()
+        qint64 si = nl/stepsize;
+        qint64 offset = nl-si*stepsize; // [samples]
+        qint64 ni = si-minsi;
+
+        amp.resize(dftsize);
+        if(offset==0 && ni>=0 && ni<stftlen){
+            const FFTTYPE* frame = snd->m_stft.frame(int(ni), 0, dftsize, &(amp[0]));
+            if(frame!=&(amp[0]))
+                std::copy(frame, frame+dftsize, amp.begin());
+        }
+        else if(offset>0 && interpolate && ni>=0 && ni+1<stftlen){
+            std::vector<FFTTYPE> buffer(dftsize);
+            const FFTTYPE* frame = snd->m_stft.frame(int(ni), 0, dftsize, &(amp[0]));
+            const FFTTYPE* next = snd->m_stft.frame(int(ni)+1, 0, dftsize, &(buffer[0]));
+            FFTTYPE a = FFTTYPE(offset)/stepsize;
+            for(int n=0; n<dftsize; ++n)
+                amp[n] = (1.0-a)*frame[n] + a*next[n];
+        }
+        else
+            copied = false;
+    }
+
+    m_mutex_changingparams.unlock();
+
+    return copied;
+}
+
+void STFTComputeThread::sortChunks() {
+    // Assumes m_mutex_chunks is locked
+    std::stable_sort(m_job_chunks.begin(), m_job_chunks.end(), ChunkCloserToView(*(m_job.stftts), m_job.chunksize, m_view_tstart, m_view_tend));
+}
+
+void STFTComputeThread::allocateImage(ImageParameters& params, int stftlen, int dftsize) {
+    // The current tiles are re-used if the size doesn't change
+    // (avoids flickering in progressive mode)
+    // Otherwise, the tiles are allocated only when drawn
+    params.imgstft->resize(stftlen, dftsize);
+}
+
+void STFTComputeThread::ColorMapping::prepare(const ImageParameters& params) {
+    // Prepare the loudness curve
+    uselw = params.loudnessweighting;
+    elc.clear();
+    if(uselw) {
+        int dftsize = params.stftparams.dftlen/2+1;
+        elc = std::vector<FFTTYPE>(dftsize, 0.0);
+        for(size_t u=0; u<elc.size(); ++u)
+            elc[u] = -qae::equalloudnesscurvesISO226(params.stftparams.snd->fs*double(u)/params.stftparams.dftlen, 0);
+    }
+    qmin = 0.0;   // Init shouldn't be used
+    qscale = 1.0; // Init shouldn't be used
+
+    cmap = &(QAEColorMap::getAt(params.colormap_index));
+    color = params.color;
+    cmap->setColor(color);
+    reversed = params.colormap_reversed;
+    c0 = reversed?(*cmap)(1.0):(*cmap)(0.0);
+    c1 = reversed?(*cmap)(0.0):(*cmap)(1.0);
+    colorrangemode = params.colorrangemode;
+    lower = params.lower;
+    upper = params.upper;
+    ymin = 0.0;       // Init shouldn't be used
+    divmaxmmin = 1.0; // Init shouldn't be used
+}
+
+void STFTComputeThread::ColorMapping::setQuantization(FFTTYPE stftmin, FFTTYPE stftmax) {
+    // The loudness curve is applied before the quantization
+    if(uselw && !elc.empty()){
+        stftmin += *std::min_element(elc.begin(), elc.end());
+        stftmax += *std::max_element(elc.begin(), elc.end());
+    }
+    qmin = stftmin;
+    qscale = (stftmax>stftmin)?254.0/(stftmax-stftmin):1.0;
+}
+
+void STFTComputeThread::ColorMapping::setRange(FFTTYPE stftmin, FFTTYPE stftmax) {
+    FFTTYPE ymax = 1.0; // Init shouldn't be used
+    if(colorrangemode==0){
+        ymin = stftmin+(stftmax-stftmin)*lower;
+        ymax = stftmin+(stftmax-stftmin)*upper;
+    }
+    else if(colorrangemode==1){
+        ymin = 100*lower; // Min of color range [dB]
+        ymax = 100*upper; // Max of color range [dB]
+    }
+    divmaxmmin = 1.0/(ymax-ymin);
+}
+
+QVector<QRgb> STFTComputeThread::ColorMapping::colorTable() const {
+    cmap->setColor(color); // The color map might be shared with another sound
+
+    QVector<QRgb> table(256);
+    table[0] = c0; // -Inf
+    for(int k=1; k<256; ++k){
+        FFTTYPE v = qmin+(k-0.5)/qscale; // Center of the quantization step
+        FFTTYPE y = (v-ymin)*divmaxmmin;
+        if(y<=0.0)
+            table[k] = c0;
+        else if(y>=1.0)
+            table[k] = c1;
+        else {
+            if(reversed)
+                y = 1.0-y;
+
+            table[k] = (*cmap)(y);
+        }
+    }
+
+    return table;
+}
+
+void STFTComputeThread::ColorMapping::quantize(const FFTTYPE* values, int nbegin, int nend, uchar* indices) const {
+    // Branch-free loops, so that they can be vectorized
+    // (-Inf ends up in 0 and +Inf in 255)
+    if(uselw){
+        for(int n=nbegin; n<nend; ++n)
+            indices[n-nbegin] = uchar(std::min(FFTTYPE(255.0), std::max(FFTTYPE(0.0), (values[n]+elc[n]-qmin)*qscale+FFTTYPE(1.0))));
+    }
+    else{
+        for(int n=nbegin; n<nend; ++n)
+            indices[n-nbegin] = uchar(std::min(FFTTYPE(255.0), std::max(FFTTYPE(0.0), (values[n]-qmin)*qscale+FFTTYPE(1.0))));
+    }
 }
 
 void STFTComputeThread::cancelCurrentComputation(bool waittoend) {
 //    DCOUT << "STFTComputeThread::cancelCurrentComputation" << std::endl;
-    gMW->ui->pbSTFTComputingCancel->setChecked(true);
-    if(waittoend){
-        m_mutex_computing.lock();
-        m_mutex_computing.unlock();
+    // Only the current request (the waiting ones, e.g. in the background, are still computed)
+    m_mutex_changingparams.lock();
+    if(m_computing){
+        int generation = m_running_generation;
+        m_generation.ref();
+        m_current_usercanceled = true;
+        // The next request has a new generation
+        while(waittoend && m_computing && m_running_generation==generation)
+            m_current_cond.wait(&m_mutex_changingparams);
     }
+    m_mutex_changingparams.unlock();
 }
 
-void STFTComputeThread::cancelComputation(FTSound* snd, bool closing) {
+void STFTComputeThread::cancelComputation(FTSound* snd) {
 //    DCOUT << "STFTComputeThread::cancelComputation" << std::endl;
     // Remove it from the STFT waiting queue
     m_mutex_changingparams.lock();
-    if(!m_params_todo.isEmpty()
-        && m_params_todo.stftparams.snd==snd){
-        m_params_todo.clear();
-    }
-    m_mutex_changingparams.unlock();
+    unqueue(snd);
+    if(m_params_current.stftparams.snd==snd){
+        m_generation.ref(); // Cancel its STFT computation (under the lock, so that it can't be the next request's)
 
-    // Or cancel its STFT computation
-    while(isRunning()
-          && getCurrentParameters().stftparams.snd==snd){
-        cancelCurrentComputation(true);
-        if(closing){
-            gMW->ui->lblSpectrogramInfoTxt->hide();
-            emit stftComputingStateChanged(SCSFinished);
-        }
-//        QThread::msleep(20);
+        // And wait for the thread to move on (the other sounds are kept in the queue)
+        while(m_params_current.stftparams.snd==snd)
+            m_current_cond.wait(&m_mutex_changingparams);
     }
+    m_mutex_changingparams.unlock();
 }
@@ -21,32 +21,188 @@ file provided in the source code of DFasma. Another copy can be found at
 #ifndef STFTCOMPUTETHREAD_H
 #define STFTCOMPUTETHREAD_H
 
+#include <vector>
+#include <deque>
+
 #include <QThread>
 #include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QSemaphore>
+#include <QElapsedTimer>
+#include <QVector>
+#include <QColor>
 
 #include "qaesigproc.h"
 #include "qaecolormap.h"
+#include "stftcache.h"
+#include "fftbackend.h"
 class FTSound;
+class FTFZero;
+class STFTComputeThread;
+class STFTImage;
+class STFTStorage;
+
+// Histogram of the amplitudes [dB] of the frames computed so far, to estimate
+// the range of the colors before the end of the STFT, without a full pass.
+class STFTRangeSketch
+{
+    FFTTYPE m_dbmin;
+    FFTTYPE m_step;
+    std::vector<qint64> m_bins;
+    qint64 m_count;
+
+public:
+    STFTRangeSketch() : m_dbmin(0.0), m_step(1.0), m_count(0) {}
+
+    void reset(FFTTYPE dbmin, FFTTYPE dbmax, FFTTYPE step);
+    void add(const FFTTYPE* values, int size); // The Inf and NaN values are ignored
+    void merge(STFTRangeSketch& other);        // And clear other
+    inline qint64 count() const {return m_count;}
+    FFTTYPE quantile(double q) const;          // With a precision of the step
+};
+
+// Computes ranges of STFT frames in parallel of the other workers
+// Each worker has its own FFT plan and buffers, so that they never share
+// anything else than the (read-only) signal and disjoint rows of the STFT.
+class STFTFramesWorker : public QThread
+{
+    STFTComputeThread* m_stftthread;
+
+    void run(); //Q_DECL_OVERRIDE
+
+public:
+    STFTFramesWorker(STFTComputeThread* stftthread);
+
+    FFTTransformer* m_fft;    // The FFT transformer of this worker
+    FFTTransformerFloat* m_fftf; // The one used in single precision (NULL until used)
+    std::vector<FFTTYPE> m_windowedwavseg; // The windowed signal segment to analyse
+    std::vector<FFTTYPE> m_frame;          // The frame being computed [dB]
+    std::vector<int> m_batchframes;        // The indices of the frames in the FFT's batch
+    std::vector<bool> m_batchnonzero;      // If the windowed segment of each frame is not all zero
+
+    qae::FFTwrapper* m_fftcep;      // The FFT of the cepstral liftering
+    std::vector<FFTTYPE> m_cepvalues; // Buffers of the cepstral liftering
+    std::vector<FFTTYPE> m_cc;
+
+    FFTTYPE m_stftmin; // Min and max of the frames computed by this worker [dB]
+    FFTTYPE m_stftmax;
+    STFTRangeSketch m_sketch; // The amplitudes of the frames computed since the last drawn chunk
+
+    ~STFTFramesWorker();
+};
 
 class STFTComputeThread : public QThread
 {
     Q_OBJECT
 
-    qae::FFTwrapper* m_fft;   // The FFT transformer
-
-    bool m_computing;
+    bool m_computing;   // A request is current (protected by m_mutex_changingparams)
+    bool m_quit;        // The thread has to end (see ~STFTComputeThread)
+    QWaitCondition m_request_cond;  // Wakes the thread up when m_computing is set or when it has to end
+    QWaitCondition m_current_cond;  // Signaled by the thread when m_params_current changes
 
     void run(); //Q_DECL_OVERRIDE
 
+    // The pool of workers computing the STFT frames
+    std::vector<STFTFramesWorker*> m_workers;
+    QSemaphore m_workers_done;  // Released once by each worker when finished
+
+    // Description of the frames to compute, shared by all the workers
+    // (set once before starting the workers, then read-only)
+    class FramesJob{
+    public:
+        FTSound* snd;
+        std::vector<FFTTYPE>* win;
+        std::vector<FFTTYPE>* wav;
+        std::vector<FFTTYPE>* stftts;
+        std::vector<double>* ahats; // For the FChT
+        FTFZero* ff0;
+        STFTStorage* stft;
+        qreal gain;
+        qint64 snddelay;
+        int stepsize;
+        int dftlen;
+        int dftsize;
+        int timefreqtrans;
+        int cepliftorder;
+        bool cepliftpresdc;
+        int minsi;
+        int stftlen;
+        int chunksize;
+        int batchsize;                  // The number of frames transformed at once (DFT only)
+        bool singleprecision;           // Use the workers' m_fftf for the batches
+        std::vector<bool> todo; // If not empty, the frames to compute (the others are re-used)
+
+        // For the cepstral liftering
+        std::vector<FFTTYPE> lifter;    // Weights of the cepstral coefs [1,cepliftorder]
+        bool lifterdirect;              // Use direct cosine sums instead of FFTs
+        std::vector<FFTTYPE> costable;  // cos(2*pi*n/dftlen), for the direct sums
+
+        // For the progressive mode
+        bool progressive;
+        bool rangesketch;               // Fill the workers' m_sketch (automatic color range)
+        STFTImage* img;
+    };
+    FramesJob m_job;
+    QAtomicInt m_job_framesdone;    // The number of frames done, for the progress bar
+    QAtomicInt m_job_newcolumns;    // Some image columns have been drawn since the last image update
+    QAtomicInt m_job_memoryfull;    // A worker ran out of memory
+
+    mutable QMutex m_mutex_chunks;  // To protect the access to the variables below
+    std::deque<int> m_job_chunks;   // The first frame of each chunk which remains to compute
+    FFTTYPE m_job_runningmin;       // Min and max of all the chunks already computed [dB]
+    FFTTYPE m_job_runningmax;
+    STFTRangeSketch m_job_sketch;   // The amplitudes of all the chunks already computed
+    double m_view_tstart;           // The visible time range [s]
+    double m_view_tend;
+    void sortChunks();              // Order the remaining chunks by distance to the visible time range
+
+    friend class STFTFramesWorker;
+    void computeFrames(STFTFramesWorker* worker); // Compute chunks of frames until there is no more to do
+    void computeFrame(STFTFramesWorker* worker, int ni); // FChT only
+    void logToDB(STFTFramesWorker* worker, FFTTYPE* frame);
+    void storeFrame(STFTFramesWorker* worker, int ni, const FFTTYPE* frame);
+    template<typename T, class Transformer>
+    void computeFramesBatch(STFTFramesWorker* worker, Transformer* fft, int count); // The frames in worker->m_batchframes
+    void drawChunk(STFTFramesWorker* worker, int nibegin, int niend);
+    void updateJobColors(STFTImage* img);
+
+    // Each request is computed with the generation current when it started,
+    // incrementing it cancels this request asap, but none of the following ones.
+    QAtomicInt m_generation;        // (incremented under m_mutex_changingparams, but by the workers)
+    int m_running_generation;       // The generation of the current request (set with it, under m_mutex_changingparams)
+    bool m_current_usercanceled;    // The current request is canceled by the user (see cancelCurrentComputation)
+    QElapsedTimer m_progress_lastemit;
+    static const int PROGRESSINTERVAL = 50; // Min time between two progress signals [ms]
+    void reportProgress(int percent);
+    void prepareLifter(STFTFramesWorker* worker);
+    void lifterFFT(STFTFramesWorker* worker, FFTTYPE* frame);
+    void lifterDirect(STFTFramesWorker* worker, FFTTYPE* frame);
+    int m_lifterbench_dftlen;   // The last liftering benchmarked
+    int m_lifterbench_order;
+    bool m_lifterbench_direct;
+    int reuseFrames(const STFTParameters& prevparams, const STFTStorage& prevstft, const STFTParameters& params, int minsi, FFTTYPE& stftmin, FFTTYPE& stftmax);
+
 public:
     enum STFTComputingState {SCSIdle, SCSDFT, SCSIMG, SCSFinished, SCSCanceled, SCSMemoryFull};
-    void cancelComputation(FTSound* snd, bool closing=false);
+    void cancelComputation(FTSound* snd);
 
     inline bool isComputing() const {return m_computing;}
+    inline bool isCanceled() const {return m_generation.load()!=m_running_generation;}
+
+    void setViewRange(double tstart, double tend);
+
+    // Copies the amplitudes [dB] of the frame of snd's STFT whose window starts at the sample index nl,
+    // if this STFT is complete and computed with the same window, DFT length, gain and delay
+    // (without cepstral liftering nor reduced precision). This never waits for the STFT thread.
+    // With interpolate, a window starting between two frames gets the linear interpolation of their amplitudes.
+    // Returns false if no frame can be used.
+    bool copyFrame(FTSound* snd, const std::vector<FFTTYPE>& win, int dftlen, FFTTYPE ampscale, qint64 delay, qint64 nl, bool interpolate, std::vector<FFTTYPE>& amp);
 
 signals:
     void stftComputingStateChanged(int state);
     void stftProgressing(int);
+    void stftImageUpdated(); // Some new image columns are ready (progressive mode only)
 
 public slots:
     void cancelCurrentComputation(bool waittoend=false);
@@ -68,6 +224,11 @@ public:
         int timefreqtrans;
         int cepliftorder;
         bool cepliftpresdc;
+        int precision;  // Storage of the values (see STFTStorage::Precision)
+        bool ondisk;    // Keep the values in a temporary file
+        qint64 rangestart; // The part of the timeline to analyse [sample index]
+        qint64 rangeend;   // (the whole sound if rangeend<0)
+        bool singleprecision; // Compute the DFTs in single precision (for display only)
 
         void clear(){
             computestft = true;
@@ -79,12 +240,17 @@ public:
             dftlen = -1;
             cepliftorder = -1;
             cepliftpresdc = false;
+            precision = 0;
+            ondisk = false;
+            rangestart = 0;
+            rangeend = -1;
+            singleprecision = false;
         }
 
         STFTParameters(){
             clear();
         }
-        STFTParameters(FTSound* reqnd, const std::vector<FFTTYPE>& reqwin, int reqstepsize, int reqdftlen, int reqtimefreqtrans, int reqcepliftorder, bool reqcepliftpresdc);
+        STFTParameters(FTSound* reqnd, const std::vector<FFTTYPE>& reqwin, int reqstepsize, int reqdftlen, int reqtimefreqtrans, int reqcepliftorder, bool reqcepliftpresdc, int reqprecision=0, bool reqondisk=false, qint64 reqrangestart=0, qint64 reqrangeend=-1, bool reqsingleprecision=false);
 
 //        bool is_stftpart_equal(const Parameters& param) const;
         bool operator==(const STFTParameters& param) const;
@@ -92,13 +258,16 @@ public:
             return !((*this)==param);
         }
 
+        // The frames of param can be re-used, up to a gain and a shift of frames
+        bool isReusableFrom(const STFTParameters& param) const;
+
         inline bool isEmpty() const {return snd==NULL;}
     };
 
     class ImageParameters{
     public:
         STFTParameters stftparams;
-        QImage* imgstft;
+        STFTImage* imgstft;
         int colormap_index;
         bool colormap_reversed;
         FFTTYPE lower;
@@ -106,6 +275,8 @@ public:
         bool loudnessweighting;
         int colorrangemode;
         QColor color;   // Used when colormap_index=
+        bool progressive; // Compute and draw the visible frames first (doesn't change the result)
+        bool background;  // Prefetched while another sound is selected (doesn't change the result)
 
         void clear(){
             stftparams.clear();
@@ -115,12 +286,14 @@ public:
             upper = -1;
             loudnessweighting = false;
             colorrangemode = -1;
+            progressive = false;
+            background = false;
         }
 
         ImageParameters(){
             clear();
         }
-        ImageParameters(STFTComputeThread::STFTParameters reqSTFTparams, QImage* reqImgSTFT, int reqcolormap_index, bool reqcolormap_reversed, FFTTYPE reqlower, FFTTYPE requpper, bool reqloudnessweighting, int reqcolorrangemode, QColor reqcolor){
+        ImageParameters(STFTComputeThread::STFTParameters reqSTFTparams, STFTImage* reqImgSTFT, int reqcolormap_index, bool reqcolormap_reversed, FFTTYPE reqlower, FFTTYPE requpper, bool reqloudnessweighting, int reqcolorrangemode, QColor reqcolor, bool reqprogressive=false){
             clear();
             stftparams = reqSTFTparams;
             imgstft = reqImgSTFT;
@@ -131,6 +304,7 @@ public:
             loudnessweighting = reqloudnessweighting;
             colorrangemode = reqcolorrangemode;
             color = reqcolor;
+            progressive = reqprogressive;
         }
 
         bool operator==(const ImageParameters& param){
@@ -166,20 +340,66 @@ public:
         }
 
         inline bool isEmpty(){return stftparams.isEmpty() || colormap_index==-1;}
+
+        // If true, the images differ only by their color tables
+        bool hasSameIndices(const ImageParameters& param) const {
+            return stftparams==param.stftparams
+                && imgstft==param.imgstft
+                && loudnessweighting==param.loudnessweighting;
+        }
     };
 
+    // Map the STFT values [dB] to the 8bits indices of the image (quantization),
+    // and these indices to the colors of the image (color table).
+    // Changing the color map or the color range only changes the color table.
+    class ColorMapping{
+    public:
+        // Quantization
+        bool uselw;
+        std::vector<FFTTYPE> elc; // The loudness curve
+        FFTTYPE qmin;   // Value of index 1 (index 0 is for -Inf) [dB]
+        FFTTYPE qscale; // Indices per dB
+
+        // Colors
+        QAEColorMap* cmap;
+        QColor color;
+        bool reversed;
+        QRgb c0;
+        QRgb c1;
+        int colorrangemode;
+        FFTTYPE lower;
+        FFTTYPE upper;
+        FFTTYPE ymin;
+        FFTTYPE divmaxmmin;
+
+        void prepare(const ImageParameters& params);
+        void setQuantization(FFTTYPE stftmin, FFTTYPE stftmax);
+        void setRange(FFTTYPE stftmin, FFTTYPE stftmax);
+        QVector<QRgb> colorTable() const;
+
+        // The indices of the values [nbegin,nend[ of a frame
+        void quantize(const FFTTYPE* values, int nbegin, int nend, uchar* indices) const;
+    };
+    void allocateImage(ImageParameters& params, int stftlen, int dftsize);
+    ColorMapping m_job_mapping; // The color mapping used in progressive mode
+
+
+    QByteArray cacheKey(const STFTParameters& params, int stftlen, int minsi, int samplesize);
+
+    void compute(ImageParameters reqImgParams, bool background=false); // Entry point
 
-    void compute(ImageParameters reqImgParams);     // Entry point
+    STFTCache m_cache;  // The STFTs computed previously
 
     mutable QMutex m_mutex_computing;       // To protect the access to the FFT and external variables
     mutable QMutex m_mutex_changingparams;  // To protect the access to the parameters below
     mutable QMutex m_mutex_changingstft;    // To protect the access to the STFT (times, values, etc.)
-    mutable QMutex m_mutex_imageallocation; // To protect the access to the image when allocating
 
     inline const ImageParameters& getCurrentParameters() const {return m_params_current;}
 
-    ImageParameters m_params_todo;      // The params which has to be done by the thread
+    std::deque<ImageParameters> m_params_queue; // The params which have to be done by the thread,
+                                                // by decreasing priority (at most one per sound)
     ImageParameters m_params_current;   // The params which is in preparation by the thread
+    void unqueue(FTSound* snd);
 
     ~STFTComputeThread();
 };
@@ -0,0 +1,332 @@
+/*
+Copyright (C) 2015  Gilles Degottex <gilles.degottex@gmail.com>
+
+This file is part of DFasma.
+
+DFasma is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DFasma is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available in the LICENSE.txt
+file provided in the source code of DFasma. Another copy can be found at
+<http://www.gnu.org/licenses/>.
+*/
+
+#include "stftimage.h"
+#include "stftstorage.h"
+
+#include <algorithm>
+
+#include <QPainter>
+
+STFTImage::STFTImage()
+    : m_width(0)
+    , m_height(0)
+    , m_ntilesy(0)
+    , m_allocatedsize(0)
+    , m_background(qRgb(255, 255, 255))
+    , m_source(NULL)
+{
+}
+
+qint64 STFTImage::allocatedSize() const {
+    m_mutex.lock();
+    qint64 size = m_allocatedsize;
+    m_mutex.unlock();
+    return size;
+}
+
+void STFTImage::releaseTile(QImage* &img) {
+    // Assumes m_mutex is locked
+    if(img){
+        m_allocatedsize -= img->byteCount();
+        delete img;
+        img = NULL;
+    }
+}
+
+void STFTImage::releaseTiles(int levelbegin) {
+    // Assumes m_mutex is locked
+    for(size_t l=levelbegin; l<m_levels.size(); ++l)
+        for(size_t ti=0; ti<m_levels[l].tiles.size(); ++ti)
+            releaseTile(m_levels[l].tiles[ti]);
+}
+
+void STFTImage::resize(int width, int height) {
+    m_mutex.lock();
+    if(width!=m_width || height!=m_height){
+        releaseTiles();
+        m_width = width;
+        m_height = height;
+        m_ntilesy = (m_height+TILESIZE-1)/TILESIZE;
+
+        // Down to a single column
+        m_levels.clear();
+        int levelwidth = m_width;
+        do{
+            Level level;
+            level.width = levelwidth;
+            level.ntilesx = (level.width+TILESIZE-1)/TILESIZE;
+            level.tiles.assign(level.ntilesx*m_ntilesy, NULL);
+            m_levels.push_back(level);
+            levelwidth = (levelwidth+1)/2;
+        }
+        while(levelwidth>1 && int(m_levels.size())<MAXLEVELS);
+    }
+    m_mutex.unlock();
+}
+
+void STFTImage::fill(QRgb background) {
+    m_mutex.lock();
+    releaseTiles();
+    m_background = background;
+    m_mutex.unlock();
+}
+
+void STFTImage::setColorTable(const QVector<QRgb>& colortable) {
+    m_mutex.lock();
+    m_colortable = colortable;
+    if(!m_colortable.empty())
+        m_background = m_colortable[0];
+    for(size_t l=0; l<m_levels.size(); ++l)
+        for(size_t ti=0; ti<m_levels[l].tiles.size(); ++ti)
+            if(m_levels[l].tiles[ti])
+                m_levels[l].tiles[ti]->setColorTable(m_colortable);
+    m_mutex.unlock();
+}
+
+bool STFTImage::setColors(const STFTComputeThread::ColorMapping& mapping) {
+    STFTComputeThread::ColorMapping colors = mapping;
+    m_mutex.lock();
+    bool hassource = m_source!=NULL;
+    colors.qmin = m_sourcemapping.qmin; // Written by the compute thread
+    colors.qscale = m_sourcemapping.qscale;
+    m_mutex.unlock();
+    if(!hassource)
+        return false;
+
+    setColorTable(colors.colorTable());
+
+    return true;
+}
+
+QImage* STFTImage::tile(int level, int tx, int ty, bool allocate) {
+    // Assumes m_mutex is locked
+    QImage* &img = m_levels[level].tiles[ty*m_levels[level].ntilesx+tx];
+    // The downsampled levels can only be rendered with the source
+    // (otherwise the full resolution tiles might still change)
+    if(img==NULL && allocate && (level==0 || m_source)){
+        img = new QImage(std::min(TILESIZE, m_levels[level].width-tx*TILESIZE), std::min(TILESIZE, m_height-ty*TILESIZE), QImage::Format_Indexed8);
+        if(img->isNull()){
+            delete img;
+            img = NULL;
+            return NULL;
+        }
+        m_allocatedsize += img->byteCount();
+        img->setColorTable(m_colortable);
+
+        if(m_source && level==0)
+            drawTile(img, tx, ty, m_source, tx*TILESIZE, tx*TILESIZE+img->width(), m_sourcemapping);
+        else if(m_source)
+            downsampleTile(level, img, tx, ty);
+        else
+            img->fill(0);
+    }
+    return img;
+}
+
+void STFTImage::drawTile(QImage* img, int tx, int ty, const STFTStorage* stft, int cbegin, int cend, const STFTComputeThread::ColorMapping& mapping) const {
+    // Don't use bits(), which would detach the tile if it is being painted
+    uchar* bits = const_cast<uchar*>(img->constBits());
+    int bytesperline = img->bytesPerLine();
+    int rbegin = ty*TILESIZE;
+    int rend = rbegin+img->height();
+    int nbegin = m_height-rend; // This one has reversed y
+    int nend = m_height-rbegin;
+    std::vector<FFTTYPE> buffer(m_height);
+    std::vector<uchar> indices(nend-nbegin);
+
+    for(int c=cbegin; c<cend; c++){
+        const FFTTYPE* stftfrpa = stft->frame(c, nbegin, nend, &(buffer[0]));
+
+        mapping.quantize(stftfrpa, nbegin, nend, &(indices[0]));
+
+        uchar* pimgb = bits+(c-tx*TILESIZE)+(img->height()-1)*bytesperline;
+        for(int n=0; n<nend-nbegin; n++, pimgb-=bytesperline)
+            *pimgb = indices[n];
+    }
+}
+
+void STFTImage::downsampleTile(int level, QImage* img, int tx, int ty) {
+    // Assumes m_mutex is locked
+    // The tile covers the two tiles 2*tx and 2*tx+1 of the level below,
+    // which are rendered first if necessary (down to the source for level 0).
+    // Each column is the max of two columns of the level below
+    // (the quantization is monotonic, so the max of the indices is the index of the max)
+    uchar* bits = const_cast<uchar*>(img->constBits());
+    int bytesperline = img->bytesPerLine();
+    for(int half=0; half<2; ++half){
+        int cbegin = half*(TILESIZE/2);
+        int cend = std::min(img->width(), cbegin+TILESIZE/2);
+        if(cbegin>=cend)
+            break;
+
+        const QImage* prev = tile(level-1, 2*tx+half, ty, true);
+        for(int r=0; r<img->height(); ++r){
+            uchar* row = bits+r*bytesperline;
+            if(prev==NULL){
+                std::fill(row+cbegin, row+cend, uchar(0)); // Couldn't be allocated
+                continue;
+            }
+            const uchar* prevrow = prev->constBits()+r*prev->bytesPerLine();
+            int prevwidth = prev->width();
+            for(int c=cbegin; c<cend; ++c){
+                int pc = 2*(c-cbegin);
+                uchar index = prevrow[pc];
+                if(pc+1<prevwidth)
+                    index = std::max(index, prevrow[pc+1]);
+                row[c] = index;
+            }
+        }
+    }
+}
+
+bool STFTImage::drawColumns(const STFTStorage* stft, int sibegin, int siend, const STFTComputeThread::ColorMapping& mapping) {
+    bool alldrawn = true;
+    for(int tx=sibegin/TILESIZE; tx*TILESIZE<siend; ++tx){
+        int tsibegin = std::max(sibegin, tx*TILESIZE);
+        int tsiend = std::min(siend, (tx+1)*TILESIZE);
+        for(int ty=0; ty<m_ntilesy; ++ty){
+            m_mutex.lock();
+            QImage* img = tile(0, tx, ty, true);
+            m_mutex.unlock();
+            if(img)
+                drawTile(img, tx, ty, stft, tsibegin, tsiend, mapping);
+            else
+                alldrawn = false;
+        }
+    }
+    return alldrawn;
+}
+
+void STFTImage::setSource(const STFTStorage* stft, const STFTComputeThread::ColorMapping& mapping) {
+    m_mutex.lock();
+    releaseTiles(1); // Have to be rendered again with the new source
+    m_source = stft;
+    m_sourcemapping = mapping;
+    m_mutex.unlock();
+}
+
+bool STFTImage::hasSource() const {
+    m_mutex.lock();
+    bool hassource = m_source!=NULL;
+    m_mutex.unlock();
+    return hassource;
+}
+
+void STFTImage::releaseSource() {
+    m_mutex.lock();
+    releaseTiles(1); // Can't be rendered anymore
+    m_source = NULL;
+    m_mutex.unlock();
+}
+
+void STFTImage::releaseTilesOutside(int xbegin, int xend, qint64 maxsize) {
+    m_mutex.lock();
+    // Without source, a released tile couldn't be rendered again
+    if(m_source && m_allocatedsize>maxsize){
+        for(size_t l=0; l<m_levels.size(); ++l){
+            for(int tx=0; tx<m_levels[l].ntilesx; ++tx){
+                if((qint64(tx+1)*TILESIZE<<l)>xbegin && (qint64(tx)*TILESIZE<<l)<xend)
+                    continue;
+                for(int ty=0; ty<m_ntilesy; ++ty)
+                    releaseTile(m_levels[l].tiles[ty*m_levels[l].ntilesx+tx]);
+            }
+        }
+    }
+    m_mutex.unlock();
+}
+
+void STFTImage::draw(QPainter* painter, const QRectF& trgrect, const QRectF& srcrect) {
+    if(srcrect.width()<=0.0 || srcrect.height()<=0.0)
+        return;
+
+    m_mutex.lock();
+
+    // Pick the level which is the closest to the number of pixels on screen
+    // (the downsampled levels exist only with the source)
+    int level = 0;
+    double trgwidth = painter->transform().mapRect(trgrect).width(); // [pixels]
+    if(m_source && trgwidth>0.0){
+        double ratio = srcrect.width()/trgwidth;
+        while(level+1<int(m_levels.size()) && ratio>=2.0){
+            ratio /= 2;
+            level++;
+        }
+    }
+    double scale = 1.0/(1<<level);
+    QRectF levelsrcrect(srcrect.left()*scale, srcrect.top(), srcrect.width()*scale, srcrect.height());
+
+    double sx = trgrect.width()/levelsrcrect.width();
+    double sy = trgrect.height()/levelsrcrect.height();
+
+    int txbegin = std::max(0, int(levelsrcrect.left())/TILESIZE);
+    int txend = std::min(m_levels[level].ntilesx-1, int(levelsrcrect.right())/TILESIZE);
+    int tybegin = std::max(0, int(levelsrcrect.top())/TILESIZE);
+    int tyend = std::min(m_ntilesy-1, int(levelsrcrect.bottom())/TILESIZE);
+    for(int tx=txbegin; tx<=txend; ++tx){
+        for(int ty=tybegin; ty<=tyend; ++ty){
+            QRectF tilerect(tx*TILESIZE, ty*TILESIZE, std::min(TILESIZE, m_levels[level].width-tx*TILESIZE), std::min(TILESIZE, m_height-ty*TILESIZE));
+            QRectF src = levelsrcrect.intersected(tilerect);
+            if(src.isEmpty())
+                continue;
+            QRectF trg(trgrect.left()+(src.left()-levelsrcrect.left())*sx, trgrect.top()+(src.top()-levelsrcrect.top())*sy, src.width()*sx, src.height()*sy);
+
+            // Render again the released tiles, if possible
+            QImage* img = tile(level, tx, ty, m_source!=NULL);
+            if(img)
+                painter->drawImage(trg, *img, src.translated(-tilerect.left(), -tilerect.top()));
+            else
+                painter->fillRect(trg, QColor(m_background));
+        }
+    }
+    m_mutex.unlock();
+}
+
+QImage STFTImage::toImage() {
+    m_mutex.lock();
+    QImage img(m_width, m_height, QImage::Format_ARGB32);
+    if(!img.isNull()){
+        img.fill(m_background);
+        QPainter painter(&img);
+        for(int tx=0; !m_levels.empty() && tx<m_levels[0].ntilesx; ++tx){
+            for(int ty=0; ty<m_ntilesy; ++ty){
+                QImage* timg = m_levels[0].tiles[ty*m_levels[0].ntilesx+tx];
+                if(timg)
+                    painter.drawImage(QPoint(tx*TILESIZE, ty*TILESIZE), *timg);
+                else if(m_source){
+                    QImage rendered(std::min(TILESIZE, m_width-tx*TILESIZE), std::min(TILESIZE, m_height-ty*TILESIZE), QImage::Format_Indexed8);
+                    if(!rendered.isNull()){
+                        rendered.setColorTable(m_colortable);
+                        drawTile(&rendered, tx, ty, m_source, tx*TILESIZE, tx*TILESIZE+rendered.width(), m_sourcemapping);
+                        painter.drawImage(QPoint(tx*TILESIZE, ty*TILESIZE), rendered);
+                    }
+                }
+            }
+        }
+    }
+    m_mutex.unlock();
+    return img;
+}
+
+STFTImage::~STFTImage() {
+    m_mutex.lock();
+    releaseTiles();
+    m_mutex.unlock();
+}
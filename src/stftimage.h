@@ -0,0 +1,115 @@
+/*
+Copyright (C) 2015  Gilles Degottex <gilles.degottex@gmail.com>
+
+This file is part of DFasma.
+
+DFasma is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DFasma is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available in the LICENSE.txt
+file provided in the source code of DFasma. Another copy can be found at
+<http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STFTIMAGE_H
+#define STFTIMAGE_H
+
+#include <vector>
+
+#include <QImage>
+#include <QMutex>
+class QPainter;
+
+#include "stftcomputethread.h"
+class STFTStorage;
+
+// The image of a spectrogram, split in tiles of fixed size.
+// This avoids the size limit of QImage (32768 pixels) and the allocation of
+// a single huge block of memory for long files with small step sizes.
+// The tiles are allocated on demand, only when something is drawn in them.
+// They contain the quantized STFT values (8bits indices), which are mapped to
+// colors through a color table shared by all the tiles.
+// Once the image is complete, the source STFT can be attached so that the
+// off-screen tiles can be released and rendered again when needed.
+// With the source, a pyramid of images, downsampled along time by factors of 2,
+// is also rendered on demand, so that the zoomed out views don't need to rescale
+// the full image. Each level is rendered from the level below (taking the max,
+// so that the transients are kept).
+class STFTImage
+{
+public:
+    static const int TILESIZE = 1024; // [pixels]
+    static const int MAXLEVELS = 24;
+
+    STFTImage();
+
+    int width() const {return m_width;}
+    int height() const {return m_height;}
+    QRect rect() const {return QRect(0, 0, m_width, m_height);}
+    bool isNull() const {return m_width==0 || m_height==0;}
+    qint64 allocatedSize() const; // [bytes]
+
+    void resize(int width, int height); // Release all the tiles if the size changes
+    void fill(QRgb background);         // Release all the tiles
+
+    // Changes the colors of all the tiles (and the background), without drawing them again
+    void setColorTable(const QVector<QRgb>& colortable);
+    // Same, keeping the quantization of the source
+    bool setColors(const STFTComputeThread::ColorMapping& mapping);
+
+    // Draw the columns [sibegin,siend[ of the STFT stft
+    // (can be called concurrently for disjoint columns)
+    // Returns false if some tiles couldn't be allocated
+    bool drawColumns(const STFTStorage* stft, int sibegin, int siend, const STFTComputeThread::ColorMapping& mapping);
+
+    // The STFT from which the released tiles can be rendered again
+    // (has to be released before any modification of the STFT or of the image)
+    void setSource(const STFTStorage* stft, const STFTComputeThread::ColorMapping& mapping);
+    void releaseSource();
+    bool hasSource() const;
+    void releaseTilesOutside(int xbegin, int xend, qint64 maxsize);
+
+    void draw(QPainter* painter, const QRectF& trgrect, const QRectF& srcrect);
+    QImage toImage();
+
+    ~STFTImage();
+
+private:
+    STFTImage(const STFTImage&);
+    STFTImage& operator=(const STFTImage&);
+
+    mutable QMutex m_mutex; // To protect the access to the tiles
+    int m_width;
+    int m_height;
+    int m_ntilesy;
+
+    // Level l is downsampled by 2^l along time
+    class Level{
+    public:
+        int width;
+        int ntilesx;
+        std::vector<QImage*> tiles; // NULL if not allocated
+    };
+    std::vector<Level> m_levels;
+    qint64 m_allocatedsize; // [bytes]
+    QRgb m_background;
+    QVector<QRgb> m_colortable;
+
+    const STFTStorage* m_source;
+    STFTComputeThread::ColorMapping m_sourcemapping;
+
+    void releaseTiles(int levelbegin=0);
+    void releaseTile(QImage* &img);
+    QImage* tile(int level, int tx, int ty, bool allocate);
+    void drawTile(QImage* img, int tx, int ty, const STFTStorage* stft, int cbegin, int cend, const STFTComputeThread::ColorMapping& mapping) const;
+    void downsampleTile(int level, QImage* img, int tx, int ty);
+};
+
+#endif // STFTIMAGE_H
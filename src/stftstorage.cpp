@@ -0,0 +1,201 @@
+/*
+Copyright (C) 2015  Gilles Degottex <gilles.degottex@gmail.com>
+
+This file is part of DFasma.
+
+DFasma is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DFasma is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available in the LICENSE.txt
+file provided in the source code of DFasma. Another copy can be found at
+<http://www.gnu.org/licenses/>.
+*/
+
+#include "stftstorage.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <new>
+
+#include <QDir>
+#include <QTemporaryFile>
+#include <QIODevice>
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+#include <QStorageInfo>
+#endif
+
+#define INT16_INF (-32768) // Encodes -Inf
+
+STFTStorage::STFTStorage()
+    : m_stftlen(0)
+    , m_dftsize(0)
+    , m_precision(SPFull)
+    , m_data(NULL)
+    , m_file(NULL)
+    , m_dbmin(0.0)
+    , m_dbstep(1.0)
+{
+}
+
+int STFTStorage::elementSize() const {
+    if(m_precision==SPFloat32)
+        return sizeof(float);
+    else if(m_precision==SPInt16)
+        return sizeof(qint16);
+    return sizeof(FFTTYPE);
+}
+
+qint64 STFTStorage::allocatedSize() const {
+    return qint64(m_stftlen)*m_dftsize*elementSize();
+}
+
+void STFTStorage::allocate(int stftlen, int dftsize, int precision, FFTTYPE dbmin, FFTTYPE dbmax, bool ondisk) {
+    clear();
+
+    m_stftlen = stftlen;
+    m_dftsize = dftsize;
+    m_precision = precision;
+    m_dbmin = dbmin;
+    m_dbstep = (dbmax-dbmin)/65534; // [-32767,32767]
+
+    // Allocate it at once, to be sure the OS will reject it if it's too big
+    // (Linux tends to overcommit small memory allocations,
+    //  and ends up killing the app when it understands, too late,
+    //  that it doesn't have the memory)
+    try{
+        if(ondisk)
+            allocateOnDisk();
+        else
+            m_data = new char[allocatedSize()];
+    }
+    catch(std::bad_alloc& err){
+        clear();
+        throw;
+    }
+}
+
+void STFTStorage::allocateOnDisk() {
+    // The file is removed when closed
+    m_file = new QTemporaryFile(QDir::tempPath()+"/dfasma_stft_XXXXXX");
+    if(!m_file->open())
+        throw std::bad_alloc();
+
+    #if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    // Check the space beforehand, writing in the mapping of a full disk would crash
+    QStorageInfo storage(QDir::tempPath());
+    if(storage.bytesAvailable()<allocatedSize())
+        throw std::bad_alloc();
+    #endif
+
+    if(!m_file->resize(allocatedSize()))
+        throw std::bad_alloc();
+
+    m_data = (char*)(m_file->map(0, allocatedSize()));
+    if(m_data==NULL)
+        throw std::bad_alloc();
+}
+
+void STFTStorage::clear() {
+    if(m_file){
+        if(m_data)
+            m_file->unmap((uchar*)m_data);
+        delete m_file;
+        m_file = NULL;
+    }
+    else if(m_data){
+        delete[] m_data;
+    }
+    m_data = NULL;
+    m_stftlen = 0;
+    m_dftsize = 0;
+}
+
+void STFTStorage::swap(STFTStorage& other) {
+    std::swap(m_stftlen, other.m_stftlen);
+    std::swap(m_dftsize, other.m_dftsize);
+    std::swap(m_precision, other.m_precision);
+    std::swap(m_data, other.m_data);
+    std::swap(m_file, other.m_file);
+    std::swap(m_dbmin, other.m_dbmin);
+    std::swap(m_dbstep, other.m_dbstep);
+}
+
+void STFTStorage::setFrame(int si, const FFTTYPE* values) {
+    qint64 offset = qint64(si)*m_dftsize;
+
+    if(m_precision==SPFloat32){
+        float* p = ((float*)m_data)+offset;
+        for(int n=0; n<m_dftsize; ++n)
+            p[n] = float(values[n]);
+    }
+    else if(m_precision==SPInt16){
+        qint16* p = ((qint16*)m_data)+offset;
+        for(int n=0; n<m_dftsize; ++n){
+            if(qIsInf(values[n]) && values[n]<0)
+                p[n] = INT16_INF;
+            else
+                p[n] = qint16(std::floor(0.5+std::min(FFTTYPE(32767), std::max(FFTTYPE(-32767), (values[n]-m_dbmin)/m_dbstep-32767))));
+        }
+    }
+    else{
+        std::copy(values, values+m_dftsize, ((FFTTYPE*)m_data)+offset);
+    }
+}
+
+const FFTTYPE* STFTStorage::frame(int si, int nbegin, int nend, FFTTYPE* buffer) const {
+    qint64 offset = qint64(si)*m_dftsize;
+
+    if(m_precision==SPFloat32){
+        const float* p = ((const float*)m_data)+offset;
+        for(int n=nbegin; n<nend; ++n)
+            buffer[n] = p[n];
+    }
+    else if(m_precision==SPInt16){
+        const qint16* p = ((const qint16*)m_data)+offset;
+        for(int n=nbegin; n<nend; ++n){
+            if(p[n]==INT16_INF)
+                buffer[n] = -std::numeric_limits<FFTTYPE>::infinity();
+            else
+                buffer[n] = m_dbmin+(p[n]+32767)*m_dbstep;
+        }
+    }
+    else{
+        return ((const FFTTYPE*)m_data)+offset; // No need to copy
+    }
+
+    return buffer;
+}
+
+#define STFTSTORAGE_IOCHUNK (qint64(16)*1024*1024)
+
+bool STFTStorage::write(QIODevice* dev) const {
+    qint64 size = allocatedSize();
+    for(qint64 pos=0; pos<size; pos+=STFTSTORAGE_IOCHUNK){
+        qint64 len = std::min(STFTSTORAGE_IOCHUNK, size-pos);
+        if(dev->write(m_data+pos, len)!=len)
+            return false;
+    }
+    return true;
+}
+
+bool STFTStorage::read(QIODevice* dev) {
+    qint64 size = allocatedSize();
+    for(qint64 pos=0; pos<size; pos+=STFTSTORAGE_IOCHUNK){
+        qint64 len = std::min(STFTSTORAGE_IOCHUNK, size-pos);
+        if(dev->read(m_data+pos, len)!=len)
+            return false;
+    }
+    return true;
+}
+
+STFTStorage::~STFTStorage() {
+    clear();
+}
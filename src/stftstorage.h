@@ -0,0 +1,86 @@
+/*
+Copyright (C) 2015  Gilles Degottex <gilles.degottex@gmail.com>
+
+This file is part of DFasma.
+
+DFasma is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DFasma is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available in the LICENSE.txt
+file provided in the source code of DFasma. Another copy can be found at
+<http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STFTSTORAGE_H
+#define STFTSTORAGE_H
+
+#include <QtGlobal>
+class QTemporaryFile;
+class QIODevice;
+
+#include "qaesigproc.h"
+
+// The values of an STFT [dB], stored frame after frame.
+// To reduce the memory footprint of long files, the values can be stored
+// in single precision or in 16bits fixed-point (with a step adapted to the
+// dynamic range of the file), instead of the precision of FFTTYPE.
+// For files larger than the memory, the values can also be kept in a
+// temporary file mapped in memory, so that the OS pages them in and out.
+class STFTStorage
+{
+public:
+    enum Precision {SPFull=0, SPFloat32=1, SPInt16=2};
+
+    STFTStorage();
+
+    // The values out of [dbmin,dbmax] are clipped in 16bits fixed-point
+    void allocate(int stftlen, int dftsize, int precision, FFTTYPE dbmin, FFTTYPE dbmax, bool ondisk=false); // Throws std::bad_alloc
+    void clear();
+    void swap(STFTStorage& other);
+
+    inline bool isEmpty() const {return m_data==NULL;}
+    inline int size() const {return m_stftlen;}
+    inline int frameSize() const {return m_dftsize;}
+    inline int precision() const {return m_precision;}
+    inline bool isOnDisk() const {return m_file!=NULL;}
+    qint64 allocatedSize() const; // [bytes]
+
+    // Can be called concurrently for different frames
+    void setFrame(int si, const FFTTYPE* values);
+
+    // Returns p such that p[n] are the values of frame si, for n in [nbegin,nend[.
+    // If a conversion is necessary, the values are written in buffer[n].
+    const FFTTYPE* frame(int si, int nbegin, int nend, FFTTYPE* buffer) const;
+
+    // Raw copy of all the values (the storage has to be allocated for reading)
+    bool write(QIODevice* dev) const;
+    bool read(QIODevice* dev);
+
+    ~STFTStorage();
+
+private:
+    STFTStorage(const STFTStorage&);
+    STFTStorage& operator=(const STFTStorage&);
+
+    int m_stftlen;
+    int m_dftsize;
+    int m_precision;
+    char* m_data;
+    QTemporaryFile* m_file; // If on disk, m_data is its mapping
+
+    // For the 16bits fixed-point
+    FFTTYPE m_dbmin;
+    FFTTYPE m_dbstep;
+
+    int elementSize() const;
+    void allocateOnDisk();
+};
+
+#endif // STFTSTORAGE_H
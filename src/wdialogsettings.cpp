@@ -38,6 +38,7 @@ file provided in the source code of DFasma. Another copy can be found at
 #include "gvspectrumphase.h"
 #include "gvspectrumgroupdelay.h"
 #include "gvspectrogramwdialogsettings.h"
+#include "ui_gvspectrogramwdialogsettings.h"
 #include "ftlabels.h"
 #include "ftfzero.h"
 
@@ -124,6 +125,7 @@ void WDialogSettings::settingsSave() {
 
     // Save the particular global settings
     gMW->m_settings.setValue("cbPlaybackAudioOutputDevices", ui->cbPlaybackAudioOutputDevices->currentText());
+    gMW->m_settings.setValue("leSpectrogramSTFTCacheLocation", gMW->m_gvSpectrogram->m_dlgSettings->ui->leSpectrogramSTFTCacheLocation->text());
 
     // If some files are loaded, save the geometry of the views
     if(gFL->count()>0){
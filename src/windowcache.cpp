@@ -0,0 +1,154 @@
+/*
+Copyright (C) 2015  Gilles Degottex <gilles.degottex@gmail.com>
+
+This file is part of DFasma.
+
+DFasma is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DFasma is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available in the LICENSE.txt
+file provided in the source code of DFasma. Another copy can be found at
+<http://www.gnu.org/licenses/>.
+*/
+
+#include "windowcache.h"
+
+#include <list>
+
+#include <QMutex>
+#include <QString>
+
+class CachedWindow{
+public:
+    int type;
+    int length;
+    int normtype;
+    double param1;
+    double param2;
+    WindowCache::Window window;
+
+    inline qint64 windowSize() const {return qint64(length)*sizeof(FFTTYPE);} // [bytes]
+};
+
+static QMutex s_windows_mutex;              // Protects the windows
+static std::list<CachedWindow> s_windows;   // Most recently used first
+static qint64 s_windows_size = 0;           // [bytes]
+static const qint64 s_windows_limit = 32*1024*1024; // [bytes]
+
+const std::vector<FFTTYPE>& WindowCache::Window::values() const {
+    static const std::vector<FFTTYPE> s_empty;
+    if(m_values.isNull())
+        return s_empty;
+    return *m_values;
+}
+
+static std::vector<FFTTYPE>* generate(int type, int length, int normtype, double param1, double param2) {
+    std::vector<FFTTYPE>* win = new std::vector<FFTTYPE>();
+
+    if(type==0)
+        *win = qae::rectangular(length);
+    else if(type==1)
+        *win = qae::hamming(length);
+    else if(type==2)
+        *win = qae::hann(length);
+    else if(type==3)
+        *win = qae::blackman(length);
+    else if(type==4)
+        *win = qae::blackmannutall(length);
+    else if(type==5)
+        *win = qae::blackmanharris(length);
+    else if(type==6)
+        *win = qae::nutall(length);
+    else if(type==7)
+        *win = qae::flattop(length);
+    else if(type==8)
+        *win = qae::normwindow(length, param1);
+    else if(type==9)
+        *win = qae::expwindow(length, param1);
+    else if(type==10)
+        *win = qae::gennormwindow(length, param1, param2);
+    else{
+        delete win;
+        throw QString("No window selected");
+    }
+
+    double winsum = 0.0;
+    if(normtype==0) {
+        // Normalize the window's sum to 1
+        for(size_t n=0; n<win->size(); n++)
+            winsum += (*win)[n];
+    }
+    else if(normtype==1) {
+        // Normalize the window's energy to 1
+        for(size_t n=0; n<win->size(); n++)
+            winsum += (*win)[n]*(*win)[n];
+    }
+    for(size_t n=0; n<win->size(); n++)
+        (*win)[n] /= winsum;
+
+    return win;
+}
+
+WindowCache::Window WindowCache::get(int type, int length, int normtype, double param1, double param2) {
+    // The parameters which are not used by this type don't make different windows
+    if(type!=10)
+        param2 = 0.0;
+    if(type<8)
+        param1 = 0.0;
+
+    s_windows_mutex.lock();
+
+    std::list<CachedWindow>::iterator it=s_windows.begin();
+    while(it!=s_windows.end()
+          && (it->type!=type || it->length!=length || it->normtype!=normtype || it->param1!=param1 || it->param2!=param2))
+        ++it;
+
+    if(it!=s_windows.end()){
+        // Move it in front
+        s_windows.splice(s_windows.begin(), s_windows, it);
+        Window win = s_windows.front().window;
+        s_windows_mutex.unlock();
+        return win;
+    }
+
+    CachedWindow cached;
+    cached.type = type;
+    cached.length = length;
+    cached.normtype = normtype;
+    cached.param1 = param1;
+    cached.param2 = param2;
+    try{
+        cached.window = Window(generate(type, length, normtype, param1, param2));
+    }
+    catch(...){
+        s_windows_mutex.unlock();
+        throw;
+    }
+
+    s_windows.push_front(cached);
+    s_windows_size += cached.windowSize();
+
+    // Drop the least recently used ones (they are deleted once not used anymore)
+    while(s_windows_size>s_windows_limit && s_windows.size()>1){
+        s_windows_size -= s_windows.back().windowSize();
+        s_windows.pop_back();
+    }
+
+    s_windows_mutex.unlock();
+
+    return cached.window;
+}
+
+void WindowCache::clear() {
+    s_windows_mutex.lock();
+    s_windows.clear();
+    s_windows_size = 0;
+    s_windows_mutex.unlock();
+}
@@ -0,0 +1,66 @@
+/*
+Copyright (C) 2015  Gilles Degottex <gilles.degottex@gmail.com>
+
+This file is part of DFasma.
+
+DFasma is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DFasma is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available in the LICENSE.txt
+file provided in the source code of DFasma. Another copy can be found at
+<http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WINDOWCACHE_H
+#define WINDOWCACHE_H
+
+#include <vector>
+
+#include <QSharedPointer>
+
+#include "qaesigproc.h"
+
+// Keeps the normalized windows used recently, so that they are not generated
+// again at each change of the DFT parameters (e.g. while dragging the selection).
+// Shared by the spectrum and the spectrogram (thread-safe).
+// The windows are shared and never modified, so that two windows obtained
+// with the same parameters can be compared by their address only.
+class WindowCache
+{
+public:
+    class Window{
+        QSharedPointer<const std::vector<FFTTYPE> > m_values;
+
+    public:
+        Window() {}
+        explicit Window(const std::vector<FFTTYPE>* values) : m_values(values) {}
+
+        inline bool isEmpty() const {return m_values.isNull();}
+        inline size_t size() const {return m_values.isNull()?0:m_values->size();}
+        inline const FFTTYPE& operator[](size_t n) const {return (*m_values)[n];}
+        const std::vector<FFTTYPE>& values() const; // (empty if isEmpty())
+
+        // Same window of the cache
+        inline bool operator==(const Window& other) const {return m_values==other.m_values;}
+        inline bool operator!=(const Window& other) const {return m_values!=other.m_values;}
+    };
+
+    // type: As in the settings (0:rectangular, 1:hamming, 2:hann, 3:blackman, 4:blackman-nutall,
+    //       5:blackman-harris, 6:nutall, 7:flattop, 8:normal, 9:exponential, 10:generalized normal)
+    // normtype: 0:sum to 1, 1:energy to 1
+    // param1: The sigma of the (generalized) normal window or the decay of the exponential window
+    // param2: The power of the generalized normal window
+    // Throws a QString if the type is unknown.
+    static Window get(int type, int length, int normtype, double param1=0.0, double param2=0.0);
+
+    static void clear();
+};
+
+#endif // WINDOWCACHE_H
@@ -250,6 +250,8 @@ WMainWindow::WMainWindow(QStringList filestoload, QStringList gvtfilestoload, QS
     connect(ui->actionShowAmplitudeSpectrum, SIGNAL(toggled(bool)), this, SLOT(viewsDisplayedChanged()));
     connect(ui->actionShowPhaseSpectrum, SIGNAL(toggled(bool)), this, SLOT(viewsDisplayedChanged()));
     connect(ui->actionShowGroupDelaySpectrum, SIGNAL(toggled(bool)), this, SLOT(viewsDisplayedChanged()));
+    connect(ui->actionShowPhaseSpectrum, SIGNAL(toggled(bool)), this, SLOT(viewsSpectraToggled(bool)));
+    connect(ui->actionShowGroupDelaySpectrum, SIGNAL(toggled(bool)), this, SLOT(viewsSpectraToggled(bool)));
     connect(m_dlgSettings->ui->sbViewsToolBarSizes, SIGNAL(valueChanged(int)), this, SLOT(changeToolBarSizes(int)));
     viewsDisplayedChanged();
 
@@ -349,7 +351,7 @@ WMainWindow::~WMainWindow() {
 //    DCOUT << "WMainWindow::~WMainWindow()" << std::endl;
 
     m_gvSpectrogram->m_stftcomputethread->cancelCurrentComputation(true);
-    m_gvSpectrumAmplitude->m_fftresizethread->cancelCurrentComputation(true);
+    m_gvSpectrumAmplitude->m_dftcomputethread->cancelCurrentComputation(true);
 
     gFL->selectAll();
     gFL->selectedFilesClose();
@@ -597,6 +599,12 @@ void WMainWindow::viewsDisplayedChanged() {
     gMW->m_gvSpectrumAmplitude->selectionSetTextInForm();
 }
 
+void WMainWindow::viewsSpectraToggled(bool show)
+{
+    if(show && gFL->ftsnds.size()>0)
+        m_gvSpectrumAmplitude->updateDFTs(); // The phase and group delay might not be computed yet
+}
+
 void WMainWindow::viewsSpectrogramToggled(bool show)
 {
     if(show && gFL->ftsnds.size()>0)
@@ -1067,6 +1075,8 @@ void WMainWindow::audioStateChanged(QAudio::State state){
         ui->actionPlay->setIcon(style()->standardIcon(QStyle::SP_MediaPlay));
         if(m_playingftsound)
             m_playingftsound->stopPlay();
+        if(m_gvSpectrumAmplitude->m_aFollowPlayCursor->isChecked())
+            m_gvSpectrumAmplitude->updateDFTs(); // Replace the spectra interpolated from the STFT by the exact ones
     }
 }
 
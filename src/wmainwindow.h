@@ -106,6 +106,7 @@ private slots:
     void setSelectionMode(bool checked);
     void setEditMode(bool checked);
     void viewsDisplayedChanged();
+    void viewsSpectraToggled(bool show);
     void viewsSpectrogramToggled(bool show);
     void changeToolBarSizes(int size);
     void execAbout();